@@ -0,0 +1,415 @@
+//libxdf is a static C++ library to load XDF files
+//Copyright (c) 2017-2020, Yida Lin, Clemens Brunner, Paul Sajda, Josef Faller
+//
+//Distributed under the BSD 2-Clause License. See LICENSE for details.
+
+
+#include "resampling.h"
+
+#include "smarc/smarc.h"      //resampling library
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <future>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace
+{
+struct Cache
+{
+    std::mutex mutex;
+    std::map<std::string, std::shared_future<std::shared_ptr<PFilter> > > filters;
+    std::string directory;
+};
+
+Cache& cache()
+{
+    static Cache instance;
+    return instance;
+}
+
+//every parameter that changes the designed filter or how it filters, printed exactly
+std::string cacheKey(int fsin, int fsout, const ResampleSpec &spec)
+{
+    std::ostringstream key;
+    key << std::setprecision(17) << fsin << ' ' << fsout << ' ' << spec.bandwidth << ' '
+        << spec.rp << ' ' << spec.rs << ' ' << spec.tol << ' ' << spec.searchFastConversion
+        << ' ' << spec.ratios << ' ' << static_cast<int>(spec.design) << ' ' << spec.deterministic;
+    return key.str();
+}
+
+//file name in the storage directory: the rates for readability, plus a 64-bit FNV-1a hash of the key
+std::string storageFileName(int fsin, int fsout, const std::string &key)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : key)
+    {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+
+    std::ostringstream name;
+    name << "pfilter-" << fsin << '-' << fsout << '-' << std::hex << std::setw(16)
+         << std::setfill('0') << hash << ".bin";
+    return name.str();
+}
+
+//a missing or rejected file, or one for other rates, is a cache miss: the filter
+//is designed again and its file replaced
+PFilter* loadFilter(const std::filesystem::path &path, int fsin, int fsout)
+{
+    PFilter* pfilt = smarc_load_pfilter(path.string().c_str());
+    if (pfilt && (smarc_get_fs_in(pfilt) != fsin || smarc_get_fs_out(pfilt) != fsout))
+    {
+        smarc_destroy_pfilter(pfilt);
+        pfilt = nullptr;
+    }
+    return pfilt;
+}
+
+//write to a unique temporary file first and rename it into place, so that
+//processes sharing the directory never see a partially written filter
+void storeFilter(PFilter* pfilt, const std::filesystem::path &path)
+{
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+
+    std::random_device random;
+    std::filesystem::path temporary = path;
+    temporary += ".tmp" + std::to_string(random());
+
+    if (smarc_save_pfilter(pfilt, temporary.string().c_str()) == 0)
+        std::filesystem::rename(temporary, path, error);
+    std::filesystem::remove(temporary, error);
+}
+
+PState* initState(PFilter* filter, int channels) { return smarc_init_pstate_multi_f(filter, channels); }
+FState* initState(FFilter* filter, int channels) { return smarc_init_fstate(filter, channels); }
+void resetState(PState* state, PFilter* filter) { smarc_reset_pstate(state, filter); }
+void resetState(FState* state, FFilter* filter) { smarc_reset_fstate(state, filter); }
+void destroyState(PState* state) { smarc_destroy_pstate(state); }
+void destroyState(FState* state) { smarc_destroy_fstate(state); }
+
+//states released by resamplers of any thread, oldest first, for resamplers
+//created later with the same filter and channel count. The pool is shared by
+//the process, so that states outlive the threads that used them: the worker
+//threads of Xdf::resample() are new on each call
+template <class Filter, class State>
+class StatePool
+{
+public:
+    StatePool()
+    {
+        entries.reserve(SIZE);
+    }
+
+    ~StatePool()
+    {
+        for (Entry &entry : entries)
+            destroyState(entry.state);
+    }
+
+    State* acquire(const std::shared_ptr<Filter> &filter, int channels)
+    {
+        State* state = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto it = entries.begin(); it != entries.end(); ++it)
+            {
+                if (it->filter == filter && it->channels == channels)
+                {
+                    state = it->state;
+                    entries.erase(it);
+                    break;
+                }
+            }
+        }
+        //reset or create the state outside the lock
+        if (!state)
+            return initState(filter.get(), channels);
+        resetState(state, filter.get());
+        return state;
+    }
+
+    void release(std::shared_ptr<Filter> filter, int channels, State* state)
+    {
+        Entry evicted{};
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (entries.size() == SIZE)
+            {
+                evicted = std::move(entries.front());
+                entries.erase(entries.begin());
+            }
+            entries.push_back({ std::move(filter), channels, state });
+        }
+        if (evicted.state)
+            destroyState(evicted.state);
+    }
+
+    static StatePool& shared()
+    {
+        static StatePool pool;
+        return pool;
+    }
+
+private:
+    //enough for the streams of a recording resampled by several threads
+    static const size_t SIZE = 32;
+
+    struct Entry
+    {
+        std::shared_ptr<Filter> filter;
+        int channels = 0;
+        State* state = nullptr;
+    };
+    std::mutex mutex;
+    std::vector<Entry> entries;
+};
+
+//input is given to smarc in pieces of at most this many frames, keeping
+//frame counts within int whatever the span length and the ratio
+const size_t MAX_PIECE = 1 << 20;
+}
+
+ResampleSpec ResampleSpec::preset(ResampleQuality quality)
+{
+    ResampleSpec spec;
+    switch (quality)
+    {
+    case ResampleQuality::Draft:
+        spec.bandwidth = 0.8;
+        spec.rp = 1;
+        spec.rs = 60;
+        spec.searchFastConversion = true;
+        spec.design = FilterDesign::Kaiser;
+        break;
+    case ResampleQuality::Standard:
+        spec.bandwidth = 0.9;
+        spec.rs = 100;
+        spec.searchFastConversion = true;
+        break;
+    case ResampleQuality::High:
+        spec.searchFastConversion = true;
+        break;
+    case ResampleQuality::Custom:
+        break;
+    }
+    return spec;
+}
+
+std::shared_ptr<PFilter> FilterCache::get(int fsin, int fsout, const ResampleSpec &spec)
+{
+    const std::string key = cacheKey(fsin, fsout, spec);
+    std::promise<std::shared_ptr<PFilter> > promise;
+    std::string directory;
+
+    {
+        std::unique_lock<std::mutex> lock(cache().mutex);
+        auto it = cache().filters.find(key);
+        if (it != cache().filters.end())
+        {
+            //designed or being designed by another thread; wait without holding the lock
+            std::shared_future<std::shared_ptr<PFilter> > filter = it->second;
+            lock.unlock();
+            return filter.get();
+        }
+        cache().filters.emplace(key, promise.get_future().share());
+        directory = cache().directory;
+    }
+
+    //design outside the lock so that different filters are designed concurrently
+    std::shared_ptr<PFilter> filter;
+    try
+    {
+        std::filesystem::path path;
+        PFilter* pfilt = nullptr;
+        if (!directory.empty())
+        {
+            path = std::filesystem::path(directory) / storageFileName(fsin, fsout, key);
+            pfilt = loadFilter(path, fsin, fsout);
+        }
+
+        const bool designed = !pfilt;
+        if (designed)
+            pfilt = smarc_init_pfilter_design(fsin, fsout, spec.bandwidth, spec.rp, spec.rs, spec.tol,
+                                              spec.ratios.empty() ? NULL : spec.ratios.c_str(),
+                                              spec.searchFastConversion ? 1 : 0,
+                                              spec.design == FilterDesign::Kaiser ? SMARC_DESIGN_KAISER
+                                                                                  : SMARC_DESIGN_REMEZ);
+        if (pfilt)
+        {
+            filter.reset(pfilt, smarc_destroy_pfilter);
+            smarc_set_fft_mode(pfilt, spec.deterministic ? SMARC_FFT_DIRECT : SMARC_FFT_MEASURED);
+        }
+        if (filter && designed && !path.empty())
+            storeFilter(pfilt, path);
+    }
+    catch (...)
+    {
+        //threads already waiting get the error; later requests design again
+        {
+            std::lock_guard<std::mutex> lock(cache().mutex);
+            cache().filters.erase(key);
+        }
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+    promise.set_value(filter);
+    return filter;
+}
+
+void FilterCache::setStorageDirectory(const std::string &directory)
+{
+    std::lock_guard<std::mutex> lock(cache().mutex);
+    cache().directory = directory;
+}
+
+void FilterCache::clear()
+{
+    std::lock_guard<std::mutex> lock(cache().mutex);
+    cache().filters.clear();
+}
+
+Resampler::Resampler(double fsin, int fsout, int channels, const ResampleSpec &spec)
+    : channelCount(channels)
+{
+    if (channels < 1)
+        return;
+    if (fsin == fsout)
+        passThrough = true;
+    else if (fsin == std::floor(fsin))
+        pfilter = FilterCache::get((int) fsin, fsout, spec);
+    else
+        ffilter.reset(smarc_init_ffilter(fsin, fsout, spec.bandwidth, spec.rs), smarc_destroy_ffilter);
+    if (pfilter)
+        pstate = StatePool<PFilter, PState>::shared().acquire(pfilter, channels);
+    else if (ffilter)
+        fstate = StatePool<FFilter, FState>::shared().acquire(ffilter, channels);
+}
+
+Resampler::Resampler(std::shared_ptr<PFilter> filter, int channels)
+    : pfilter(std::move(filter)), channelCount(channels)
+{
+    if (pfilter && channels >= 1)
+        pstate = StatePool<PFilter, PState>::shared().acquire(pfilter, channels);
+}
+
+Resampler::Resampler(std::shared_ptr<FFilter> filter, int channels, double start)
+    : ffilter(std::move(filter)), channelCount(channels)
+{
+    if (ffilter && channels >= 1)
+    {
+        fstate = StatePool<FFilter, FState>::shared().acquire(ffilter, channels);
+        smarc_set_fstate_start(fstate, start);
+    }
+}
+
+Resampler::~Resampler()
+{
+    release();
+}
+
+Resampler::Resampler(Resampler &&other) noexcept
+    : pfilter(std::move(other.pfilter)), ffilter(std::move(other.ffilter)),
+      pstate(std::exchange(other.pstate, nullptr)), fstate(std::exchange(other.fstate, nullptr)),
+      passThrough(std::exchange(other.passThrough, false)), channelCount(other.channelCount)
+{
+}
+
+Resampler &Resampler::operator=(Resampler &&other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        pfilter = std::move(other.pfilter);
+        ffilter = std::move(other.ffilter);
+        pstate = std::exchange(other.pstate, nullptr);
+        fstate = std::exchange(other.fstate, nullptr);
+        passThrough = std::exchange(other.passThrough, false);
+        channelCount = other.channelCount;
+    }
+    return *this;
+}
+
+//give the state back to the pool
+void Resampler::release()
+{
+    if (pstate)
+        StatePool<PFilter, PState>::shared().release(pfilter, channelCount, std::exchange(pstate, nullptr));
+    if (fstate)
+        StatePool<FFilter, FState>::shared().release(ffilter, channelCount, std::exchange(fstate, nullptr));
+}
+
+size_t Resampler::outputFrames(size_t inputFrames) const
+{
+    if (!valid())
+        return 0;
+    if (passThrough)
+        return inputFrames;
+    auto pieceOutput = [&](size_t frames) -> size_t
+    {
+        return pstate ? smarc_get_output_buffer_size(pfilter.get(), (int) frames)
+                      : smarc_get_foutput_buffer_size(ffilter.get(), (int) frames);
+    };
+    return inputFrames / MAX_PIECE * pieceOutput(MAX_PIECE) + pieceOutput(inputFrames % MAX_PIECE);
+}
+
+size_t Resampler::process(std::span<const float> input, std::span<float> output)
+{
+    if (!valid())
+        return 0;
+    if (input.size() % channelCount != 0)
+        throw std::length_error("Resampler::process: input holds a partial frame");
+    size_t inputLeft = input.size() / channelCount;
+    if (output.size() / channelCount < outputFrames(inputLeft))
+        throw std::length_error("Resampler::process: output buffer too small");
+    if (passThrough)
+    {
+        std::copy(input.begin(), input.end(), output.begin());
+        return inputLeft;
+    }
+
+    const float* in = input.data();
+    size_t written = 0;
+    do
+    {
+        const int frames = (int) std::min(inputLeft, MAX_PIECE);
+        float* out = output.data() + written * channelCount;
+        const int room = (int) std::min<size_t>(output.size() / channelCount - written, INT_MAX);
+        written += pstate ? smarc_resample_multi_f(pfilter.get(), pstate, in, frames, out, room)
+                          : smarc_fresample_f(ffilter.get(), fstate, in, frames, out, room);
+        in += (size_t) frames * channelCount;
+        inputLeft -= frames;
+    } while (inputLeft > 0);
+    return written;
+}
+
+size_t Resampler::flush(std::span<float> output)
+{
+    if (!valid() || passThrough)
+        return 0;
+    const int room = (int) std::min<size_t>(output.size() / channelCount, INT_MAX);
+    return pstate ? smarc_resample_flush_multi_f(pfilter.get(), pstate, output.data(), room)
+                  : smarc_fresample_flush_f(ffilter.get(), fstate, output.data(), room);
+}
+
+void Resampler::reset(double start)
+{
+    if (pstate)
+        smarc_reset_pstate(pstate, pfilter.get());
+    if (fstate)
+    {
+        smarc_reset_fstate(fstate, ffilter.get());
+        smarc_set_fstate_start(fstate, start);
+    }
+}
@@ -0,0 +1,212 @@
+//libxdf is a static C++ library to load XDF files
+//Copyright (c) 2017-2020, Yida Lin, Clemens Brunner, Paul Sajda, Josef Faller
+//
+//Distributed under the BSD 2-Clause License. See LICENSE for details.
+
+/*! \file resampling.h
+ * \brief Resampling filter parameters, a process-wide cache of designed filters
+ * and a resampler of interleaved float frames
+ */
+
+#ifndef RESAMPLING_H
+#define RESAMPLING_H
+
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string>
+
+struct PFilter;
+struct FFilter;
+struct PState;
+struct FState;
+
+/*! \enum ResampleQuality
+ *
+ * Presets trading resampling accuracy for speed, see ResampleSpec::preset().
+ */
+enum class ResampleQuality
+{
+    Draft,      /*!< 60 dB stopband, 80% bandwidth: for display and quick looks. */
+    Standard,   /*!< 100 dB stopband, 90% bandwidth. */
+    High,       /*!< 140 dB stopband, 95% bandwidth: the accuracy of the default parameters. */
+    Custom      /*!< The default parameters, to be adjusted field by field. */
+};
+
+/*! \enum FilterDesign
+ *
+ * Methods to design the filter of each resampling stage, see ResampleSpec::design.
+ */
+enum class FilterDesign
+{
+    Remez,      /*!< Equiripple filters: the shortest filters, long ones take up to seconds to design. */
+    Kaiser      /*!< Kaiser windowed sinc filters: designed in microseconds, with about 60% more taps. */
+};
+
+/*! \struct ResampleSpec
+ *
+ * Design parameters of a _smarc_ multi-stage polyphase resampling filter.
+ * The defaults are the parameters Xdf::resample() has always used.
+ */
+struct ResampleSpec
+{
+    /*!
+     * \brief The parameters of a quality preset.
+     *
+     * All presets but `Custom` search for the stage decomposition with the
+     * fewest operations, which resamples uneven ratios such as 2048 to 250 Hz
+     * tens of times faster than the default decomposition. Lower stopband
+     * attenuation and bandwidth mean shorter filters again: `Draft` is about
+     * an order of magnitude faster than `High`.
+     *
+     * The search may pick long filters that take a while to design (tens of
+     * seconds for `High` and uneven ratios); FilterCache designs each one
+     * only once, and once per machine with a storage directory. `Draft`
+     * designs Kaiser windowed filters, so that its filters are ready at once
+     * for any pair of rates.
+     */
+    static ResampleSpec preset(ResampleQuality quality);
+
+    double bandwidth = 0.95;    /*!< Fraction of the maximum possible bandwidth to keep, between 0 and 1. */
+    double rp = 0.1;            /*!< Passband ripple factor in dB. */
+    double rs = 140;            /*!< Stopband attenuation in dB. */
+    double tol = 0.000001;      /*!< Sample rate conversion error tolerance. */
+    std::string ratios;         /*!< Optional user-defined stages in the form "L1/M1 L2/M2 ...". */
+    bool searchFastConversion = false;  /*!< Search for the fastest stage decomposition instead of using the default one. */
+    FilterDesign design = FilterDesign::Remez;  /*!< Stage filter design method: Kaiser for tools that change rates on the fly. */
+    bool useEffectiveRate = false;      /*!< Resample from each stream's measured `effective_sample_rate` instead of its nominal rate, correcting clock drift. */
+    bool deterministic = false;         /*!< Filter long decimation stages in direct form even where the FFT is faster. The FFT is chosen by timings measured at run time, so only this makes repeated runs bit-identical. */
+};
+
+/*! \class FilterCache
+ *
+ * Process-wide cache of designed _smarc_ filters.
+ *
+ * Designing a filter (stage selection and Remez design of every stage) is
+ * expensive and used to be repeated for every stream and every file with the
+ * same pair of sample rates. FilterCache designs each distinct filter once
+ * and hands out shared, read-only references to it. It is safe to use from
+ * several threads: concurrent requests for the same filter wait for a single
+ * design, requests for different filters are designed concurrently.
+ *
+ * Optionally, designed filters are also written to a storage directory and
+ * reloaded from there, so that separate processes (e.g. batch jobs over many
+ * files) pay the design cost only once.
+ */
+class FilterCache
+{
+public:
+    /*!
+     * \brief Get the filter resampling from `fsin` to `fsout` with the given
+     * design parameters, designing (or loading) it on first use.
+     * \return The filter, or nullptr if it cannot be designed.
+     *
+     * If designing, loading or storing the filter throws, the exception is
+     * passed on to this call and to the calls waiting for the same filter,
+     * and the next request designs it again.
+     */
+    static std::shared_ptr<PFilter> get(int fsin, int fsout, const ResampleSpec &spec = ResampleSpec());
+
+    /*!
+     * \brief Set the directory used to store designed filters across processes.
+     *
+     * Files are machine-specific binary dumps of the filter coefficients.
+     * An empty string (the default) disables the on-disk store.
+     */
+    static void setStorageDirectory(const std::string &directory);
+
+    /*!
+     * \brief Drop all filters from the in-memory cache. Filters still in use stay valid.
+     */
+    static void clear();
+};
+
+/*! \class Resampler
+ *
+ * Resamples one signal of interleaved float channels (sample i of channel c
+ * at `[i * channels + c]`), owning its _smarc_ filter state.
+ *
+ * Integer input rates go through a multi-stage polyphase filter from
+ * FilterCache, other rates through a fractional-ratio filter. Filter states
+ * are pooled process-wide: a Resampler takes a released state of the same
+ * filter and channel count when there is one, whichever thread released it,
+ * and gives its state back when it is destroyed. Resampling a stream again,
+ * as repeated Xdf::resample() calls do, then allocates no filter state.
+ * The pool keeps up to 32 released states of each kind, which keep their
+ * filter alive.
+ *
+ * A Resampler is used by one thread at a time; it may be moved but not copied.
+ */
+class Resampler
+{
+public:
+    /*!
+     * \brief Resample from `fsin` to `fsout` with a filter designed from `spec`
+     * (from FilterCache if `fsin` is an integer). If both rates are equal, the
+     * frames are copied through unchanged.
+     */
+    Resampler(double fsin, int fsout, int channels = 1, const ResampleSpec &spec = ResampleSpec());
+
+    /*!
+     * \brief Resample with a multi-stage polyphase filter, e.g. from FilterCache::get().
+     */
+    Resampler(std::shared_ptr<PFilter> filter, int channels = 1);
+
+    /*!
+     * \brief Resample with a fractional-ratio filter, output frame 0 being the
+     * signal at input position `start` (in input frames).
+     */
+    Resampler(std::shared_ptr<FFilter> filter, int channels = 1, double start = 0);
+
+    ~Resampler();
+    Resampler(Resampler &&other) noexcept;
+    Resampler &operator=(Resampler &&other) noexcept;
+    Resampler(const Resampler &) = delete;
+    Resampler &operator=(const Resampler &) = delete;
+
+    /*!
+     * \brief Whether the filter could be designed. An invalid Resampler outputs nothing.
+     */
+    bool valid() const { return pstate || fstate || passThrough; }
+
+    int channels() const { return channelCount; }
+
+    /*!
+     * \brief Output frames to provide room for when processing `inputFrames` frames.
+     */
+    size_t outputFrames(size_t inputFrames) const;
+
+    /*!
+     * \brief Resample the frames of `input`, writing the output frames available so far.
+     * \param input Whole interleaved frames.
+     * \param output Room for at least `outputFrames(input.size() / channels())` frames.
+     * \return The number of frames written.
+     * \exception std::length_error if input holds a partial frame or output is too small.
+     */
+    size_t process(std::span<const float> input, std::span<float> output);
+
+    /*!
+     * \brief Write the frames still held by the filter once the input is over.
+     * May be called until it returns 0.
+     * \return The number of frames written.
+     */
+    size_t flush(std::span<float> output);
+
+    /*!
+     * \brief Start over with another signal (and for a fractional-ratio
+     * filter, output frame 0 at input position `start`).
+     */
+    void reset(double start = 0);
+
+private:
+    void release();
+
+    std::shared_ptr<PFilter> pfilter;
+    std::shared_ptr<FFilter> ffilter;
+    struct PState* pstate = nullptr;
+    struct FState* fstate = nullptr;
+    bool passThrough = false;   //equal rates: frames are copied as they are
+    int channelCount;
+};
+
+#endif // RESAMPLING_H
@@ -0,0 +1,403 @@
+/**
+ * Smarc
+ *
+ * FFT filtering of long decimation stages, added to the copy of Smarc bundled with libxdf.
+ *
+ * This file is part of Smarc.
+ *
+ * Smarc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Smarc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fftfilt.h"
+#include "filtering.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// FFT sizes considered, as powers of two
+#define MIN_FFT_LOG2 6
+#define MAX_FFT_LOG2 15
+// filters shorter than this are always filtered in direct form
+#define MIN_FFT_FILTER_LENGTH 64
+
+/**
+ * In-place complex FFT of n points (interleaved re/im), n a power of two.
+ * - twiddles: exp(-i*pi*k/n) for k in [0,n]
+ * - bitrev: bit reversal permutation of n points
+ */
+static void fft(double* SMARC_RESTRICT z, int n, const double* SMARC_RESTRICT twiddles, const int* SMARC_RESTRICT bitrev)
+{
+	for (int i=0;i<n;i++) {
+		const int j = bitrev[i];
+		if (j>i) {
+			double t = z[2*i]; z[2*i] = z[2*j]; z[2*j] = t;
+			t = z[2*i+1]; z[2*i+1] = z[2*j+1]; z[2*j+1] = t;
+		}
+	}
+	for (int len=2;len<=n;len*=2) {
+		const int half = len/2;
+		const int step = 2*(n/len);
+		for (int s=0;s<n;s+=len) {
+			double* a = z + 2*s;
+			double* b = a + 2*half;
+			for (int j=0;j<half;j++) {
+				const double wr = twiddles[2*j*step];
+				const double wi = twiddles[2*j*step+1];
+				const double br = b[2*j]*wr - b[2*j+1]*wi;
+				const double bi = b[2*j]*wi + b[2*j+1]*wr;
+				b[2*j] = a[2*j] - br;
+				b[2*j+1] = a[2*j+1] - bi;
+				a[2*j] += br;
+				a[2*j+1] += bi;
+			}
+		}
+	}
+}
+
+/**
+ * Spectrum X[0..n] of N=2n real samples packed as z[m] = x[2m] + i*x[2m+1],
+ * from the FFT Z of z: X[k] = E[k] + W^k*O[k] with E and O the spectra of
+ * the even and odd samples.
+ */
+static void unpack_real(const double* SMARC_RESTRICT Z, int n, const double* SMARC_RESTRICT twiddles, double* SMARC_RESTRICT X)
+{
+	for (int k=0;k<=n;k++) {
+		const int a = k<n ? k : 0;
+		const int b = k>0 ? n-k : 0;
+		const double er = 0.5*(Z[2*a] + Z[2*b]);
+		const double ei = 0.5*(Z[2*a+1] - Z[2*b+1]);
+		const double o_r = 0.5*(Z[2*a+1] + Z[2*b+1]);
+		const double o_i = -0.5*(Z[2*a] - Z[2*b]);
+		const double wr = twiddles[2*k];
+		const double wi = twiddles[2*k+1];
+		X[2*k] = er + wr*o_r - wi*o_i;
+		X[2*k+1] = ei + wr*o_i + wi*o_r;
+	}
+}
+
+/**
+ * Inverse of unpack_real, up to a factor 2: packs the spectrum X[0..n] of
+ * real samples into the conjugate of Z, so that a forward FFT of the result
+ * gives the conjugate of n*z.
+ */
+static void pack_real(const double* SMARC_RESTRICT X, int n, const double* SMARC_RESTRICT twiddles, double* SMARC_RESTRICT Z)
+{
+	for (int k=0;k<n;k++) {
+		const double xr = X[2*k];
+		const double xi = X[2*k+1];
+		const double yr = X[2*(n-k)];
+		const double yi = -X[2*(n-k)+1];
+		const double er = xr + yr;
+		const double ei = xi + yi;
+		const double dr = xr - yr;
+		const double di = xi - yi;
+		// O = (X[k] - conj(X[n-k])) * conj(W^k)
+		const double wr = twiddles[2*k];
+		const double wi = -twiddles[2*k+1];
+		const double o_r = dr*wr - di*wi;
+		const double o_i = dr*wi + di*wr;
+		// Z = E + i*O, conjugated
+		Z[2*k] = er - o_i;
+		Z[2*k+1] = -(ei + o_r);
+	}
+}
+
+// gather N samples of one polyphase component of one channel as packed complex values
+static void gather(const void* signal, int sample_size, int stride, int N, double* SMARC_RESTRICT z)
+{
+	if (sample_size==sizeof(float)) {
+		const float* s = (const float*) signal;
+		for (int m=0;m<N;m++)
+			z[m] = s[(size_t)m*stride];
+	} else {
+		const double* s = (const double*) signal;
+		for (int m=0;m<N;m++)
+			z[m] = s[(size_t)m*stride];
+	}
+}
+
+static void init_tables(int N, double** twiddles, int** bitrev)
+{
+	const int n = N/2;
+	*twiddles = malloc(2*(n+1)*sizeof(double));
+	for (int k=0;k<=n;k++) {
+		(*twiddles)[2*k] = cos(M_PI*k/n);
+		(*twiddles)[2*k+1] = -sin(M_PI*k/n);
+	}
+	*bitrev = malloc(n*sizeof(int));
+	int bits = 0;
+	while ((1<<bits)<n)
+		bits++;
+	for (int i=0;i<n;i++) {
+		int r = 0;
+		for (int b=0;b<bits;b++)
+			if (i & (1<<b))
+				r |= 1 << (bits-1-b);
+		(*bitrev)[i] = r;
+	}
+}
+
+static double now()
+{
+	struct timespec ts;
+	timespec_get(&ts,TIME_UTC);
+	return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+// timings measured on first use, 0 until measured: seconds per direct form
+// tap (per channel for interleaved channels), and per forward transform
+// (gather and real FFT) and spectrum accumulation of 2^i points. States and
+// filters are created from several threads: the timings are read and
+// measured under s_timings_lock, which also keeps measurements from running
+// concurrently and disturbing each other.
+#ifdef _WIN32
+static SRWLOCK s_timings_lock = SRWLOCK_INIT;
+#define lock_timings() AcquireSRWLockExclusive(&s_timings_lock)
+#define unlock_timings() ReleaseSRWLockExclusive(&s_timings_lock)
+#else
+static pthread_mutex_t s_timings_lock = PTHREAD_MUTEX_INITIALIZER;
+#define lock_timings() pthread_mutex_lock(&s_timings_lock)
+#define unlock_timings() pthread_mutex_unlock(&s_timings_lock)
+#endif
+#define MAX_MEASURED_CHANNELS 64
+static double s_tap_time = 0.0;
+static double s_tap_time_f = 0.0;
+static double s_tap_time_multi_f[MAX_MEASURED_CHANNELS+1];
+static double s_fft_time[MAX_FFT_LOG2+1];
+static double s_mac_time[MAX_FFT_LOG2+1];
+
+// best time of a few trials of `reps` runs of body, per run
+#define MEASURE(result, reps, body) \
+	do { \
+		double best = 1e30; \
+		for (int trial=0;trial<3;trial++) { \
+			const double t0 = now(); \
+			for (int rep=0;rep<(reps);rep++) { body; } \
+			const double t = (now() - t0) / (reps); \
+			if (t<best) best = t; \
+		} \
+		result = best; \
+	} while (0)
+
+// direct form tap time, for a 1024 taps filter on one channel and a 256 taps filter on several
+static double measure_direct(int sample_size, int channels)
+{
+	const int K = channels==1 ? 1024 : 256;
+	const int reps = channels==1 ? 64 : 16;
+	const size_t n = (size_t)channels*(K + reps) + K;
+	volatile double sink = 0.0;
+	double t;
+	if (sample_size==sizeof(double)) {
+		double* signal = smarc_aligned_malloc(n*sizeof(double));
+		for (size_t i=0;i<n;i++)
+			signal[i] = sin(0.1*i);
+		MEASURE(t, reps, sink += filter_padded(signal + n - K, signal + rep, K));
+		smarc_aligned_free(signal);
+	} else {
+		float* signal = smarc_aligned_malloc(n*sizeof(float));
+		float* output = malloc(channels*sizeof(float));
+		for (size_t i=0;i<n;i++)
+			signal[i] = (float) sin(0.1*i);
+		if (channels==1) {
+			MEASURE(t, reps, sink += filter_padded_f(signal + n - K, signal + rep, K));
+		} else {
+			MEASURE(t, reps, {
+				filter_multi_f(signal + n - K, signal + (size_t)rep*channels, K, channels, output);
+				sink += output[0];
+			});
+		}
+		free(output);
+		smarc_aligned_free(signal);
+	}
+	return t / ((double)K*channels);
+}
+
+static void measure_fft(int l)
+{
+	const int N = 1 << l;
+	const int n = N/2;
+	// about 2^16 points per trial
+	const int reps = N<(1 << 16) ? (1 << 16) / N : 1;
+	float* signal = malloc(2*(size_t)N*sizeof(float));
+	double* work = calloc((size_t)N + 6*((size_t)n+1),sizeof(double));
+	for (int i=0;i<2*N;i++)
+		signal[i] = (float) sin(0.1*i);
+	double* z = work;
+	double* x = z + N;
+	double* acc = x + 2*(n+1);
+	const double* spectrum = acc + 2*(n+1);
+	double* twiddles;
+	int* bitrev;
+	init_tables(N,&twiddles,&bitrev);
+
+	volatile double sink = 0.0;
+	double fft_time, mac_time;
+	MEASURE(fft_time, reps, {
+		gather(signal + (rep&1),sizeof(float),2,N,z);
+		fft(z,n,twiddles,bitrev);
+		unpack_real(z,n,twiddles,x);
+	});
+	MEASURE(mac_time, reps, {
+		for (int k=0;k<=n;k++) {
+			acc[2*k] += x[2*k]*spectrum[2*k] - x[2*k+1]*spectrum[2*k+1];
+			acc[2*k+1] += x[2*k]*spectrum[2*k+1] + x[2*k+1]*spectrum[2*k];
+		}
+	});
+	sink += x[0] + acc[0];
+
+	free(twiddles);
+	free(bitrev);
+	free(signal);
+	free(work);
+	s_mac_time[l] = mac_time;
+	s_fft_time[l] = fft_time;
+}
+
+struct PFFTFilter* init_fftfilter(const double* filters, int K, int M)
+{
+	if (K<MIN_FFT_FILTER_LENGTH)
+		return NULL;
+
+	// FFT size with the lowest cost per output: from the smallest size
+	// holding two polyphase components, where half of each block is overlap,
+	// to 8 times that size
+	const int Kp = (K + M - 1) / M;
+	double best = 0.0;
+	int bestN = 0;
+	int l = MIN_FFT_LOG2;
+	while (l<=MAX_FFT_LOG2 && (1 << l)<2*Kp)
+		l++;
+	lock_timings();
+	for (int last=l+3;l<=last && l<=MAX_FFT_LOG2;l++) {
+		const int N = 1 << l;
+		if (s_fft_time[l]==0.0)
+			measure_fft(l);
+		const double cost = ((M+1)*s_fft_time[l] + M*s_mac_time[l]) / (N - Kp + 1);
+		if (bestN==0 || cost<best) {
+			best = cost;
+			bestN = N;
+		}
+	}
+	unlock_timings();
+	if (bestN==0)
+		return NULL;
+
+	struct PFFTFilter* fft_filter = malloc(sizeof(struct PFFTFilter));
+	const int N = bestN;
+	const int n = N/2;
+	fft_filter->N = N;
+	fft_filter->Kp = Kp;
+	fft_filter->M = M;
+	fft_filter->B = N - Kp + 1;
+	fft_filter->cost = best;
+	init_tables(N,&fft_filter->twiddles,&fft_filter->bitrev);
+
+	// conjugate spectra of the polyphase components, scaled by 1/N for the inverse transform
+	fft_filter->spectra = malloc((size_t)M*2*(n+1)*sizeof(double));
+	double* z = malloc((size_t)N*sizeof(double));
+	for (int p=0;p<M;p++) {
+		double* spectrum = fft_filter->spectra + (size_t)p*2*(n+1);
+		for (int j=0;j<N;j++) {
+			const int k = j*M + p;
+			z[j] = (j<Kp && k<K) ? filters[k] / N : 0.0;
+		}
+		fft(z,n,fft_filter->twiddles,fft_filter->bitrev);
+		unpack_real(z,n,fft_filter->twiddles,spectrum);
+		for (int k=0;k<=n;k++)
+			spectrum[2*k+1] = -spectrum[2*k+1];
+	}
+	free(z);
+	return fft_filter;
+}
+
+int fftfilter_faster(const struct PFFTFilter* fft_filter, int K, int sample_size, int channels)
+{
+	double tap_time;
+	lock_timings();
+	if (sample_size==sizeof(double)) {
+		if (s_tap_time==0.0)
+			s_tap_time = measure_direct(sample_size,1);
+		tap_time = s_tap_time;
+	} else if (channels==1) {
+		if (s_tap_time_f==0.0)
+			s_tap_time_f = measure_direct(sample_size,1);
+		tap_time = s_tap_time_f;
+	} else {
+		// the cost per channel levels off with many channels
+		const int c = channels<MAX_MEASURED_CHANNELS ? channels : MAX_MEASURED_CHANNELS;
+		if (s_tap_time_multi_f[c]==0.0)
+			s_tap_time_multi_f[c] = measure_direct(sample_size,c);
+		tap_time = s_tap_time_multi_f[c];
+	}
+	unlock_timings();
+	return fft_filter->cost < K*tap_time;
+}
+
+void destroy_fftfilter(struct PFFTFilter* fft_filter)
+{
+	free(fft_filter->spectra);
+	free(fft_filter->twiddles);
+	free(fft_filter->bitrev);
+	free(fft_filter);
+}
+
+size_t fftfilter_work_size(const struct PFFTFilter* fft_filter)
+{
+	// packed samples, spectrum of one component and accumulated spectrum
+	return (size_t)fft_filter->N + 4*((size_t)fft_filter->N/2+1);
+}
+
+void fftfilter_block(const struct PFFTFilter* fft_filter, double* work,
+		const void* signal, int sample_size, int channels, double* output)
+{
+	const int N = fft_filter->N;
+	const int n = N/2;
+	const int M = fft_filter->M;
+	const int B = fft_filter->B;
+	double* z = work;
+	double* x = z + N;
+	double* acc = x + 2*(n+1);
+
+	for (int c=0;c<channels;c++) {
+		memset(acc,0,2*(n+1)*sizeof(double));
+		for (int p=0;p<M;p++) {
+			// component p of channel c: frames p, p+M, ...
+			const char* s = (const char*) signal + ((size_t)p*channels + c)*sample_size;
+			gather(s,sample_size,M*channels,N,z);
+			fft(z,n,fft_filter->twiddles,fft_filter->bitrev);
+			unpack_real(z,n,fft_filter->twiddles,x);
+			const double* spectrum = fft_filter->spectra + (size_t)p*2*(n+1);
+			for (int k=0;k<=n;k++) {
+				acc[2*k] += x[2*k]*spectrum[2*k] - x[2*k+1]*spectrum[2*k+1];
+				acc[2*k+1] += x[2*k]*spectrum[2*k+1] + x[2*k+1]*spectrum[2*k];
+			}
+		}
+		// inverse transform: the first B samples are the valid outputs
+		pack_real(acc,n,fft_filter->twiddles,z);
+		fft(z,n,fft_filter->twiddles,fft_filter->bitrev);
+		for (int t=0;t<B;t++)
+			output[(size_t)t*channels + c] = (t&1) ? -z[t] : z[t];
+	}
+}
@@ -0,0 +1,87 @@
+/**
+ * Smarc
+ *
+ * FFT filtering of long decimation stages, added to the copy of Smarc bundled with libxdf.
+ *
+ * This file is part of Smarc.
+ *
+ * Smarc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Smarc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FFTFILT_H_
+#define FFTFILT_H_
+
+#include <stddef.h>
+
+/**
+ * Overlap-save FFT implementation of a decimation filter (L=1).
+ * The filter is split into its M polyphase components of Kp = ceil(K/M) taps,
+ * which are correlated with the M polyphase components of the signal at the
+ * output rate and summed in the frequency domain: one block costs M forward
+ * and one inverse real FFT of N points and yields B = N-Kp+1 outputs.
+ * - N: FFT size
+ * - Kp: polyphase component length
+ * - M: decimation factor
+ * - B: outputs per block, reading N*M input frames and consuming B*M
+ * - spectra: M conjugate spectra of N/2+1 complex values, scaled for the inverse FFT
+ * - twiddles: exp(-i*pi*k/(N/2)) for k in [0,N/2]
+ * - bitrev: bit reversal permutation of N/2 points
+ * - cost: measured time in seconds per output and channel
+ */
+struct PFFTFilter {
+	int N;
+	int Kp;
+	int M;
+	int B;
+	double* spectra;
+	double* twiddles;
+	int* bitrev;
+	double cost;
+};
+
+/**
+ * Create the FFT implementation of a decimation filter of K taps (as stored in
+ * PSFilter: output n is sum_k filters[k]*signal[n*M+k]), with the FFT size
+ * costing the least on this machine. Returns NULL if the filter is too short
+ * for the FFT to pay off. The returned pointer must be freed with destroy_fftfilter.
+ */
+struct PFFTFilter* init_fftfilter(const double* filters, int K, int M);
+
+/**
+ * Whether the FFT implementation is faster than the direct form with K taps,
+ * for signals of sample_size bytes (float or double) and the given number of
+ * interleaved channels. Timings are measured once per process and signal type,
+ * and may be measured from several threads.
+ */
+int fftfilter_faster(const struct PFFTFilter*, int K, int sample_size, int channels);
+
+/**
+ * Destroy a PFFTFilter
+ */
+void destroy_fftfilter(struct PFFTFilter*);
+
+/**
+ * Number of doubles of workspace needed by fftfilter_block
+ */
+size_t fftfilter_work_size(const struct PFFTFilter*);
+
+/**
+ * Compute B output frames from N*M input frames of interleaved channels.
+ * signal holds samples of sample_size bytes (float or double), output holds
+ * B*channels doubles.
+ */
+void fftfilter_block(const struct PFFTFilter*, double* work,
+		const void* signal, int sample_size, int channels, double* output);
+
+#endif /* FFTFILT_H_ */
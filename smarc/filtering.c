@@ -24,21 +24,71 @@
 
 #include "filtering.h"
 
-#ifndef __SSE2__
+#include <stddef.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
 
-double filter(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int K)
+void* smarc_aligned_malloc(size_t size)
 {
-	register double v = 0.0;
-	for (int k=0;k<K;++k)
-		v+=filt[k]*signal[k];
-	return v;
+#ifdef _WIN32
+	return _aligned_malloc(size,SMARC_FILTER_ALIGN);
+#else
+	void* ptr = NULL;
+	if (posix_memalign(&ptr,SMARC_FILTER_ALIGN,size)!=0)
+		return NULL;
+	return ptr;
+#endif
 }
 
+void smarc_aligned_free(void* ptr)
+{
+#ifdef _WIN32
+	_aligned_free(ptr);
 #else
+	free(ptr);
+#endif
+}
 
-#include <emmintrin.h>
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SMARC_X86_DISPATCH
+#endif
+
+// the padded kernels are inlined into copies for fixed filter lengths (see
+// filter_padded_kernel), where the constant K lets the compiler unroll them.
+// GCC only unrolls loops of a few iterations completely at -O3.
+#ifdef _MSC_VER
+#define SMARC_INLINE __forceinline
+#else
+#define SMARC_INLINE inline __attribute__((always_inline))
+#endif
+#if defined(__GNUC__) && !defined(__clang__)
+#define SMARC_UNROLLED __attribute__((optimize("O3")))
+#else
+#define SMARC_UNROLLED
+#endif
 
-double basic_filter(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int K)
+// filter lengths with kernels of their own: the short sub-filters that the
+// stage tables produce most often
+#define SMARC_FIXED_LENGTHS(X,isa) X(isa,8) X(isa,16) X(isa,24) X(isa,32) X(isa,40) X(isa,48)
+
+#define FIXED_KERNELS(target,isa,K) \
+SMARC_UNROLLED target static double isa##_filter_k##K(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int length) \
+{ \
+	(void) length; \
+	return isa##_filter_padded(filt,signal,K); \
+} \
+SMARC_UNROLLED target static float isa##_filter_f_k##K(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int length) \
+{ \
+	(void) length; \
+	return isa##_filter_padded_f(filt,signal,K); \
+}
+#define DEFAULT_FIXED_KERNELS(isa,K) FIXED_KERNELS(,isa,K)
+#define FIXED_CASE(isa,K) case K: return isa##_filter_k##K;
+#define FIXED_CASE_F(isa,K) case K: return isa##_filter_f_k##K;
+
+static double basic_filter(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int K)
 {
 //	printf("basic filter for K=%i\n",K);
 	register double v = 0.0;
@@ -47,7 +97,117 @@ double basic_filter(const double* SMARC_RESTRICT filt, const double* SMARC_RESTR
 	return v;
 }
 
-double sse_filtering_aligned(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int K) {
+static float basic_filter_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int K)
+{
+	register float v = 0.0f;
+	for (int k=0;k<K;++k)
+		v+=filt[k]*signal[k];
+	return v;
+}
+
+// one channel of interleaved frames
+static float strided_filter_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int K, const int stride)
+{
+	register float v = 0.0f;
+	for (int k=0;k<K;++k)
+		v+=filt[k]*signal[(size_t)k*stride];
+	return v;
+}
+
+#ifndef __SSE2__
+static void basic_filter_multi_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int K,
+		const int channels, float* SMARC_RESTRICT output)
+{
+	for (int c=0;c<channels;++c)
+		output[c] = strided_filter_f(filt,signal+c,K,channels);
+}
+#endif
+
+// K is a multiple of SMARC_FILTER_PAD: four independent sums and no tail
+static SMARC_INLINE double basic_filter_padded(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int K)
+{
+	double v0 = 0.0, v1 = 0.0, v2 = 0.0, v3 = 0.0;
+	for (int k=0;k<K;k+=4) {
+		v0+=filt[k]*signal[k];
+		v1+=filt[k+1]*signal[k+1];
+		v2+=filt[k+2]*signal[k+2];
+		v3+=filt[k+3]*signal[k+3];
+	}
+	return (v0 + v1) + (v2 + v3);
+}
+
+static SMARC_INLINE float basic_filter_padded_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int K)
+{
+	float v0 = 0.0f, v1 = 0.0f, v2 = 0.0f, v3 = 0.0f;
+	for (int k=0;k<K;k+=4) {
+		v0+=filt[k]*signal[k];
+		v1+=filt[k+1]*signal[k+1];
+		v2+=filt[k+2]*signal[k+2];
+		v3+=filt[k+3]*signal[k+3];
+	}
+	return (v0 + v1) + (v2 + v3);
+}
+
+// one channel of interleaved frames, folded symmetric filter
+static float strided_folded_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int H, const int n,
+		const int stride)
+{
+	register float v = 0.0f;
+	for (int k=0;k<H;++k)
+		v+=filt[k]*(signal[(size_t)k*stride] + signal[(size_t)(n-1-k)*stride]);
+	return v;
+}
+
+#ifndef __SSE2__
+// H is a multiple of SMARC_FILTER_PAD: four independent sums and no tail
+static double basic_filter_folded(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int H, const int n)
+{
+	const double* r = signal + n - 1;
+	double v0 = 0.0, v1 = 0.0, v2 = 0.0, v3 = 0.0;
+	for (int k=0;k<H;k+=4) {
+		v0+=filt[k]*(signal[k] + r[-k]);
+		v1+=filt[k+1]*(signal[k+1] + r[-k-1]);
+		v2+=filt[k+2]*(signal[k+2] + r[-k-2]);
+		v3+=filt[k+3]*(signal[k+3] + r[-k-3]);
+	}
+	return (v0 + v1) + (v2 + v3);
+}
+
+static float basic_filter_folded_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int H, const int n)
+{
+	const float* r = signal + n - 1;
+	float v0 = 0.0f, v1 = 0.0f, v2 = 0.0f, v3 = 0.0f;
+	for (int k=0;k<H;k+=4) {
+		v0+=filt[k]*(signal[k] + r[-k]);
+		v1+=filt[k+1]*(signal[k+1] + r[-k-1]);
+		v2+=filt[k+2]*(signal[k+2] + r[-k-2]);
+		v3+=filt[k+3]*(signal[k+3] + r[-k-3]);
+	}
+	return (v0 + v1) + (v2 + v3);
+}
+
+static void basic_filter_folded_multi_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int H,
+		const int n, const int channels, const int stride, float* SMARC_RESTRICT output)
+{
+	for (int c=0;c<channels;++c)
+		output[c] = strided_folded_f(filt,signal+c,H,n,stride);
+}
+
+#define default_filter basic_filter
+#define default_filter_f basic_filter_f
+#define default_filter_multi_f basic_filter_multi_f
+#define default_filter_padded basic_filter_padded
+#define default_filter_padded_f basic_filter_padded_f
+#define default_filter_folded basic_filter_folded
+#define default_filter_folded_f basic_filter_folded_f
+#define default_filter_folded_multi_f basic_filter_folded_multi_f
+#define DEFAULT_ISA basic
+
+#else
+
+#include <emmintrin.h>
+
+static double sse_filtering_aligned(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int K) {
 //	printf("sse_filtering filt=%p signal=%p K=%i\n",filt,signal,K);
 	// filt and signal are 16 byte aligned, K % 2 = 0
 	__m128d v = _mm_setzero_pd();
@@ -65,7 +225,7 @@ double sse_filtering_aligned(const double* SMARC_RESTRICT filt, const double* SM
 	return tmp[0] + tmp[1] + filt[k]*signal[k];
 }
 
-double sse_filtering_misaligned(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int K) {
+static double sse_filtering_misaligned(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int K) {
 //	printf("sse_filtering_misaligned filt=%p signal=%p K=%i\n",filt,signal,K);
 	__m128d v = _mm_setzero_pd();
 	__m128d s = _mm_load1_pd(signal);
@@ -87,7 +247,7 @@ double sse_filtering_misaligned(const double* SMARC_RESTRICT filt, const double*
 	return tmp[0] + tmp[1];
 }
 
-double filter(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, int K)
+static double sse2_filter(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, int K)
 {
 	if (K<8)
 		return basic_filter(filt,signal,K);
@@ -105,7 +265,856 @@ double filter(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT si
 	return v + sse_filtering_misaligned(filt,signal,K);
 }
 
+static float sse2_filter_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int K)
+{
+	if (K<8)
+		return basic_filter_f(filt,signal,K);
+	// 4 floats per register, two independent accumulators;
+	// unaligned loads cost next to nothing on current CPUs
+	__m128 v0 = _mm_setzero_ps();
+	__m128 v1 = _mm_setzero_ps();
+	int k=0;
+	for (;k<K-7;k+=8) {
+		v0 = _mm_add_ps(v0,_mm_mul_ps(_mm_loadu_ps(filt + k),_mm_loadu_ps(signal + k)));
+		v1 = _mm_add_ps(v1,_mm_mul_ps(_mm_loadu_ps(filt + k + 4),_mm_loadu_ps(signal + k + 4)));
+	}
+	float tmp[4];
+	_mm_storeu_ps(tmp,_mm_add_ps(v0,v1));
+	float v = (tmp[0] + tmp[1]) + (tmp[2] + tmp[3]);
+	for (;k<K;++k)
+		v+=filt[k]*signal[k];
+	return v;
+}
 
+static void sse2_filter_multi_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int K,
+		const int channels, float* SMARC_RESTRICT output)
+{
+	// SIMD lanes across channels: each coefficient is broadcast once and
+	// multiplies 8 channels
+	int c=0;
+	for (;c<channels-7;c+=8) {
+		__m128 v0 = _mm_setzero_ps();
+		__m128 v1 = _mm_setzero_ps();
+		const float* s = signal + c;
+		for (int k=0;k<K;++k,s+=channels) {
+			const __m128 f = _mm_set1_ps(filt[k]);
+			v0 = _mm_add_ps(v0,_mm_mul_ps(f,_mm_loadu_ps(s)));
+			v1 = _mm_add_ps(v1,_mm_mul_ps(f,_mm_loadu_ps(s + 4)));
+		}
+		_mm_storeu_ps(output + c,v0);
+		_mm_storeu_ps(output + c + 4,v1);
+	}
+	for (;c<channels-3;c+=4) {
+		__m128 v = _mm_setzero_ps();
+		const float* s = signal + c;
+		for (int k=0;k<K;++k,s+=channels)
+			v = _mm_add_ps(v,_mm_mul_ps(_mm_set1_ps(filt[k]),_mm_loadu_ps(s)));
+		_mm_storeu_ps(output + c,v);
+	}
+	for (;c<channels;++c)
+		output[c] = strided_filter_f(filt,signal+c,K,channels);
+}
+
+static SMARC_INLINE double sse2_filter_padded(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int K)
+{
+	// aligned coefficients, two independent accumulators, no tail
+	__m128d v0 = _mm_setzero_pd();
+	__m128d v1 = _mm_setzero_pd();
+	for (int k=0;k<K;k+=4) {
+		v0 = _mm_add_pd(v0,_mm_mul_pd(_mm_load_pd(filt + k),_mm_loadu_pd(signal + k)));
+		v1 = _mm_add_pd(v1,_mm_mul_pd(_mm_load_pd(filt + k + 2),_mm_loadu_pd(signal + k + 2)));
+	}
+	double tmp[2];
+	_mm_storeu_pd(tmp,_mm_add_pd(v0,v1));
+	return tmp[0] + tmp[1];
+}
+
+static SMARC_INLINE float sse2_filter_padded_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int K)
+{
+	__m128 v0 = _mm_setzero_ps();
+	__m128 v1 = _mm_setzero_ps();
+	for (int k=0;k<K;k+=8) {
+		v0 = _mm_add_ps(v0,_mm_mul_ps(_mm_load_ps(filt + k),_mm_loadu_ps(signal + k)));
+		v1 = _mm_add_ps(v1,_mm_mul_ps(_mm_load_ps(filt + k + 4),_mm_loadu_ps(signal + k + 4)));
+	}
+	float tmp[4];
+	_mm_storeu_ps(tmp,_mm_add_ps(v0,v1));
+	return (tmp[0] + tmp[1]) + (tmp[2] + tmp[3]);
+}
+
+static double sse2_filter_folded(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int H, const int n)
+{
+	// mirrored samples are loaded backwards from the end of the filter and
+	// swapped, then added to their pair before the multiply
+	const double* r = signal + n - 2;
+	__m128d v0 = _mm_setzero_pd();
+	__m128d v1 = _mm_setzero_pd();
+	for (int k=0;k<H;k+=4) {
+		const __m128d m0 = _mm_loadu_pd(r - k);
+		const __m128d m1 = _mm_loadu_pd(r - k - 2);
+		const __m128d a0 = _mm_add_pd(_mm_loadu_pd(signal + k),_mm_shuffle_pd(m0,m0,1));
+		const __m128d a1 = _mm_add_pd(_mm_loadu_pd(signal + k + 2),_mm_shuffle_pd(m1,m1,1));
+		v0 = _mm_add_pd(v0,_mm_mul_pd(_mm_load_pd(filt + k),a0));
+		v1 = _mm_add_pd(v1,_mm_mul_pd(_mm_load_pd(filt + k + 2),a1));
+	}
+	double tmp[2];
+	_mm_storeu_pd(tmp,_mm_add_pd(v0,v1));
+	return tmp[0] + tmp[1];
+}
+
+static float sse2_filter_folded_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int H, const int n)
+{
+	const float* r = signal + n - 4;
+	__m128 v0 = _mm_setzero_ps();
+	__m128 v1 = _mm_setzero_ps();
+	for (int k=0;k<H;k+=8) {
+		const __m128 m0 = _mm_loadu_ps(r - k);
+		const __m128 m1 = _mm_loadu_ps(r - k - 4);
+		const __m128 a0 = _mm_add_ps(_mm_loadu_ps(signal + k),_mm_shuffle_ps(m0,m0,_MM_SHUFFLE(0,1,2,3)));
+		const __m128 a1 = _mm_add_ps(_mm_loadu_ps(signal + k + 4),_mm_shuffle_ps(m1,m1,_MM_SHUFFLE(0,1,2,3)));
+		v0 = _mm_add_ps(v0,_mm_mul_ps(_mm_load_ps(filt + k),a0));
+		v1 = _mm_add_ps(v1,_mm_mul_ps(_mm_load_ps(filt + k + 4),a1));
+	}
+	float tmp[4];
+	_mm_storeu_ps(tmp,_mm_add_ps(v0,v1));
+	return (tmp[0] + tmp[1]) + (tmp[2] + tmp[3]);
+}
+
+static void sse2_filter_folded_multi_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int H,
+		const int n, const int channels, const int stride, float* SMARC_RESTRICT output)
+{
+	// as sse2_filter_multi_f, the two frames of a pair are added first
+	int c=0;
+	for (;c<channels-7;c+=8) {
+		__m128 v0 = _mm_setzero_ps();
+		__m128 v1 = _mm_setzero_ps();
+		const float* s = signal + c;
+		const float* r = signal + (size_t)(n-1)*stride + c;
+		for (int k=0;k<H;++k,s+=stride,r-=stride) {
+			const __m128 f = _mm_set1_ps(filt[k]);
+			v0 = _mm_add_ps(v0,_mm_mul_ps(f,_mm_add_ps(_mm_loadu_ps(s),_mm_loadu_ps(r))));
+			v1 = _mm_add_ps(v1,_mm_mul_ps(f,_mm_add_ps(_mm_loadu_ps(s + 4),_mm_loadu_ps(r + 4))));
+		}
+		_mm_storeu_ps(output + c,v0);
+		_mm_storeu_ps(output + c + 4,v1);
+	}
+	for (;c<channels-3;c+=4) {
+		__m128 v = _mm_setzero_ps();
+		const float* s = signal + c;
+		const float* r = signal + (size_t)(n-1)*stride + c;
+		for (int k=0;k<H;++k,s+=stride,r-=stride)
+			v = _mm_add_ps(v,_mm_mul_ps(_mm_set1_ps(filt[k]),_mm_add_ps(_mm_loadu_ps(s),_mm_loadu_ps(r))));
+		_mm_storeu_ps(output + c,v);
+	}
+	for (;c<channels;++c)
+		output[c] = strided_folded_f(filt,signal+c,H,n,stride);
+}
+
+#define default_filter sse2_filter
+#define default_filter_f sse2_filter_f
+#define default_filter_multi_f sse2_filter_multi_f
+#define default_filter_padded sse2_filter_padded
+#define default_filter_padded_f sse2_filter_padded_f
+#define default_filter_folded sse2_filter_folded
+#define default_filter_folded_f sse2_filter_folded_f
+#define default_filter_folded_multi_f sse2_filter_folded_multi_f
+#define DEFAULT_ISA sse2
+
+#endif
+
+SMARC_FIXED_LENGTHS(DEFAULT_FIXED_KERNELS,DEFAULT_ISA)
+
+#ifndef SMARC_X86_DISPATCH
+
+FilterFunc filter_padded_kernel(const int K)
+{
+	switch (K) {
+	SMARC_FIXED_LENGTHS(FIXED_CASE,DEFAULT_ISA)
+	}
+	return default_filter_padded;
+}
+
+FilterFuncF filter_padded_kernel_f(const int K)
+{
+	switch (K) {
+	SMARC_FIXED_LENGTHS(FIXED_CASE_F,DEFAULT_ISA)
+	}
+	return default_filter_padded_f;
+}
+
+double filter(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int K)
+{
+	return default_filter(filt,signal,K);
+}
+
+float filter_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int K)
+{
+	return default_filter_f(filt,signal,K);
+}
+
+void filter_multi_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int K,
+		const int channels, float* SMARC_RESTRICT output)
+{
+	default_filter_multi_f(filt,signal,K,channels,output);
+}
+
+double filter_padded(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int K)
+{
+	return default_filter_padded(filt,signal,K);
+}
+
+float filter_padded_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int K)
+{
+	return default_filter_padded_f(filt,signal,K);
+}
+
+double filter_folded(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int H, const int n)
+{
+	return default_filter_folded(filt,signal,H,n);
+}
+
+float filter_folded_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int H, const int n)
+{
+	return default_filter_folded_f(filt,signal,H,n);
+}
+
+void filter_folded_multi_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int H, const int n,
+		const int channels, const int stride, float* SMARC_RESTRICT output)
+{
+	default_filter_folded_multi_f(filt,signal,H,n,channels,stride,output);
+}
+
+#else
+
+/*
+ * AVX2+FMA and AVX-512 kernels. They are compiled for their instruction set
+ * whatever the compiler flags, and only called when the CPU running the code
+ * supports it (see select_filters below).
+ */
+
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SMARC_TARGET(isa)
+#else
+#define SMARC_TARGET(isa) __attribute__((target(isa)))
 #endif
 
+SMARC_TARGET("avx2,fma")
+static double avx2_filter(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int K)
+{
+	if (K<8)
+		return basic_filter(filt,signal,K);
+	// 4 doubles per register, two independent fma chains
+	__m256d v0 = _mm256_setzero_pd();
+	__m256d v1 = _mm256_setzero_pd();
+	int k=0;
+	for (;k<K-7;k+=8) {
+		v0 = _mm256_fmadd_pd(_mm256_loadu_pd(filt + k),_mm256_loadu_pd(signal + k),v0);
+		v1 = _mm256_fmadd_pd(_mm256_loadu_pd(filt + k + 4),_mm256_loadu_pd(signal + k + 4),v1);
+	}
+	if (k<K-3) {
+		v0 = _mm256_fmadd_pd(_mm256_loadu_pd(filt + k),_mm256_loadu_pd(signal + k),v0);
+		k+=4;
+	}
+	v0 = _mm256_add_pd(v0,v1);
+	__m128d h = _mm_add_pd(_mm256_castpd256_pd128(v0),_mm256_extractf128_pd(v0,1));
+	h = _mm_add_sd(h,_mm_unpackhi_pd(h,h));
+	double v = _mm_cvtsd_f64(h);
+	for (;k<K;++k)
+		v+=filt[k]*signal[k];
+	return v;
+}
+
+SMARC_TARGET("avx2,fma")
+static float avx2_filter_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int K)
+{
+	if (K<8)
+		return basic_filter_f(filt,signal,K);
+	// 8 floats per register, two independent fma chains
+	__m256 v0 = _mm256_setzero_ps();
+	__m256 v1 = _mm256_setzero_ps();
+	int k=0;
+	for (;k<K-15;k+=16) {
+		v0 = _mm256_fmadd_ps(_mm256_loadu_ps(filt + k),_mm256_loadu_ps(signal + k),v0);
+		v1 = _mm256_fmadd_ps(_mm256_loadu_ps(filt + k + 8),_mm256_loadu_ps(signal + k + 8),v1);
+	}
+	if (k<K-7) {
+		v0 = _mm256_fmadd_ps(_mm256_loadu_ps(filt + k),_mm256_loadu_ps(signal + k),v0);
+		k+=8;
+	}
+	v0 = _mm256_add_ps(v0,v1);
+	__m128 h = _mm_add_ps(_mm256_castps256_ps128(v0),_mm256_extractf128_ps(v0,1));
+	h = _mm_add_ps(h,_mm_movehl_ps(h,h));
+	h = _mm_add_ss(h,_mm_shuffle_ps(h,h,1));
+	float v = _mm_cvtss_f32(h);
+	for (;k<K;++k)
+		v+=filt[k]*signal[k];
+	return v;
+}
+
+SMARC_TARGET("avx512f")
+static double avx512_filter(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int K)
+{
+	if (K<8)
+		return basic_filter(filt,signal,K);
+	// 8 doubles per register, two independent fma chains, masked tail
+	__m512d v0 = _mm512_setzero_pd();
+	__m512d v1 = _mm512_setzero_pd();
+	int k=0;
+	for (;k<K-15;k+=16) {
+		v0 = _mm512_fmadd_pd(_mm512_loadu_pd(filt + k),_mm512_loadu_pd(signal + k),v0);
+		v1 = _mm512_fmadd_pd(_mm512_loadu_pd(filt + k + 8),_mm512_loadu_pd(signal + k + 8),v1);
+	}
+	for (;k<K;k+=8) {
+		const int n = K-k<8 ? K-k : 8;
+		const __mmask8 m = (__mmask8) ((1u << n) - 1);
+		v0 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(m,filt + k),_mm512_maskz_loadu_pd(m,signal + k),v0);
+	}
+	return _mm512_reduce_add_pd(_mm512_add_pd(v0,v1));
+}
+
+SMARC_TARGET("avx512f")
+static float avx512_filter_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int K)
+{
+	if (K<8)
+		return basic_filter_f(filt,signal,K);
+	// 16 floats per register, two independent fma chains, masked tail
+	__m512 v0 = _mm512_setzero_ps();
+	__m512 v1 = _mm512_setzero_ps();
+	int k=0;
+	for (;k<K-31;k+=32) {
+		v0 = _mm512_fmadd_ps(_mm512_loadu_ps(filt + k),_mm512_loadu_ps(signal + k),v0);
+		v1 = _mm512_fmadd_ps(_mm512_loadu_ps(filt + k + 16),_mm512_loadu_ps(signal + k + 16),v1);
+	}
+	for (;k<K;k+=16) {
+		const int n = K-k<16 ? K-k : 16;
+		const __mmask16 m = (__mmask16) ((1u << n) - 1);
+		v0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m,filt + k),_mm512_maskz_loadu_ps(m,signal + k),v0);
+	}
+	return _mm512_reduce_add_ps(_mm512_add_ps(v0,v1));
+}
+
+SMARC_TARGET("avx2,fma")
+static SMARC_INLINE double avx2_filter_padded(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int K)
+{
+	// aligned coefficients, two fma chains, no tail
+	__m256d v0 = _mm256_setzero_pd();
+	__m256d v1 = _mm256_setzero_pd();
+	for (int k=0;k<K;k+=8) {
+		v0 = _mm256_fmadd_pd(_mm256_load_pd(filt + k),_mm256_loadu_pd(signal + k),v0);
+		v1 = _mm256_fmadd_pd(_mm256_load_pd(filt + k + 4),_mm256_loadu_pd(signal + k + 4),v1);
+	}
+	v0 = _mm256_add_pd(v0,v1);
+	__m128d h = _mm_add_pd(_mm256_castpd256_pd128(v0),_mm256_extractf128_pd(v0,1));
+	h = _mm_add_sd(h,_mm_unpackhi_pd(h,h));
+	return _mm_cvtsd_f64(h);
+}
+
+SMARC_TARGET("avx2,fma")
+static SMARC_INLINE float avx2_filter_padded_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int K)
+{
+	// aligned coefficients, two fma chains, at most one single register step
+	__m256 v0 = _mm256_setzero_ps();
+	__m256 v1 = _mm256_setzero_ps();
+	int k=0;
+	for (;k<K-15;k+=16) {
+		v0 = _mm256_fmadd_ps(_mm256_load_ps(filt + k),_mm256_loadu_ps(signal + k),v0);
+		v1 = _mm256_fmadd_ps(_mm256_load_ps(filt + k + 8),_mm256_loadu_ps(signal + k + 8),v1);
+	}
+	if (k<K)
+		v0 = _mm256_fmadd_ps(_mm256_load_ps(filt + k),_mm256_loadu_ps(signal + k),v0);
+	v0 = _mm256_add_ps(v0,v1);
+	__m128 h = _mm_add_ps(_mm256_castps256_ps128(v0),_mm256_extractf128_ps(v0,1));
+	h = _mm_add_ps(h,_mm_movehl_ps(h,h));
+	h = _mm_add_ss(h,_mm_shuffle_ps(h,h,1));
+	return _mm_cvtss_f32(h);
+}
+
+SMARC_TARGET("avx512f")
+static SMARC_INLINE double avx512_filter_padded(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int K)
+{
+	// aligned coefficients, two fma chains, at most one single register step
+	__m512d v0 = _mm512_setzero_pd();
+	__m512d v1 = _mm512_setzero_pd();
+	int k=0;
+	for (;k<K-15;k+=16) {
+		v0 = _mm512_fmadd_pd(_mm512_load_pd(filt + k),_mm512_loadu_pd(signal + k),v0);
+		v1 = _mm512_fmadd_pd(_mm512_load_pd(filt + k + 8),_mm512_loadu_pd(signal + k + 8),v1);
+	}
+	if (k<K)
+		v0 = _mm512_fmadd_pd(_mm512_load_pd(filt + k),_mm512_loadu_pd(signal + k),v0);
+	return _mm512_reduce_add_pd(_mm512_add_pd(v0,v1));
+}
+
+SMARC_TARGET("avx512f")
+static SMARC_INLINE float avx512_filter_padded_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int K)
+{
+	// two fma chains; filt is only aligned on 32 bytes and K is a multiple
+	// of 8, so the last step may load half a register
+	__m512 v0 = _mm512_setzero_ps();
+	__m512 v1 = _mm512_setzero_ps();
+	int k=0;
+	for (;k<K-31;k+=32) {
+		v0 = _mm512_fmadd_ps(_mm512_loadu_ps(filt + k),_mm512_loadu_ps(signal + k),v0);
+		v1 = _mm512_fmadd_ps(_mm512_loadu_ps(filt + k + 16),_mm512_loadu_ps(signal + k + 16),v1);
+	}
+	for (;k<K;k+=16) {
+		const __mmask16 m = K-k<16 ? (__mmask16) 0xff : (__mmask16) 0xffff;
+		v0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m,filt + k),_mm512_maskz_loadu_ps(m,signal + k),v0);
+	}
+	return _mm512_reduce_add_ps(_mm512_add_ps(v0,v1));
+}
+
+SMARC_TARGET("avx2,fma")
+static void avx2_filter_multi_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int K,
+		const int channels, float* SMARC_RESTRICT output)
+{
+	// 16 channels per block; even and odd taps go to separate accumulators
+	// so that four fma chains are in flight
+	int c=0;
+	for (;c<channels-15;c+=16) {
+		__m256 a0 = _mm256_setzero_ps();
+		__m256 a1 = _mm256_setzero_ps();
+		__m256 b0 = _mm256_setzero_ps();
+		__m256 b1 = _mm256_setzero_ps();
+		const float* s = signal + c;
+		int k=0;
+		for (;k<K-1;k+=2,s+=2*channels) {
+			const __m256 f = _mm256_set1_ps(filt[k]);
+			const __m256 g = _mm256_set1_ps(filt[k+1]);
+			a0 = _mm256_fmadd_ps(f,_mm256_loadu_ps(s),a0);
+			a1 = _mm256_fmadd_ps(f,_mm256_loadu_ps(s + 8),a1);
+			b0 = _mm256_fmadd_ps(g,_mm256_loadu_ps(s + channels),b0);
+			b1 = _mm256_fmadd_ps(g,_mm256_loadu_ps(s + channels + 8),b1);
+		}
+		if (k<K) {
+			const __m256 f = _mm256_set1_ps(filt[k]);
+			a0 = _mm256_fmadd_ps(f,_mm256_loadu_ps(s),a0);
+			a1 = _mm256_fmadd_ps(f,_mm256_loadu_ps(s + 8),a1);
+		}
+		_mm256_storeu_ps(output + c,_mm256_add_ps(a0,b0));
+		_mm256_storeu_ps(output + c + 8,_mm256_add_ps(a1,b1));
+	}
+	for (;c<channels-7;c+=8) {
+		__m256 v = _mm256_setzero_ps();
+		const float* s = signal + c;
+		for (int k=0;k<K;++k,s+=channels)
+			v = _mm256_fmadd_ps(_mm256_set1_ps(filt[k]),_mm256_loadu_ps(s),v);
+		_mm256_storeu_ps(output + c,v);
+	}
+	for (;c<channels;++c)
+		output[c] = strided_filter_f(filt,signal+c,K,channels);
+}
+
+SMARC_TARGET("avx512f")
+static void avx512_filter_multi_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int K,
+		const int channels, float* SMARC_RESTRICT output)
+{
+	// 32 channels per block, four fma chains as in avx2_filter_multi_f,
+	// remaining channels with masked loads and stores
+	int c=0;
+	for (;c<channels-31;c+=32) {
+		__m512 a0 = _mm512_setzero_ps();
+		__m512 a1 = _mm512_setzero_ps();
+		__m512 b0 = _mm512_setzero_ps();
+		__m512 b1 = _mm512_setzero_ps();
+		const float* s = signal + c;
+		int k=0;
+		for (;k<K-1;k+=2,s+=2*channels) {
+			const __m512 f = _mm512_set1_ps(filt[k]);
+			const __m512 g = _mm512_set1_ps(filt[k+1]);
+			a0 = _mm512_fmadd_ps(f,_mm512_loadu_ps(s),a0);
+			a1 = _mm512_fmadd_ps(f,_mm512_loadu_ps(s + 16),a1);
+			b0 = _mm512_fmadd_ps(g,_mm512_loadu_ps(s + channels),b0);
+			b1 = _mm512_fmadd_ps(g,_mm512_loadu_ps(s + channels + 16),b1);
+		}
+		if (k<K) {
+			const __m512 f = _mm512_set1_ps(filt[k]);
+			a0 = _mm512_fmadd_ps(f,_mm512_loadu_ps(s),a0);
+			a1 = _mm512_fmadd_ps(f,_mm512_loadu_ps(s + 16),a1);
+		}
+		_mm512_storeu_ps(output + c,_mm512_add_ps(a0,b0));
+		_mm512_storeu_ps(output + c + 16,_mm512_add_ps(a1,b1));
+	}
+	for (;c<channels;c+=16) {
+		const int n = channels-c<16 ? channels-c : 16;
+		const __mmask16 m = (__mmask16) ((1u << n) - 1);
+		__m512 v = _mm512_setzero_ps();
+		const float* s = signal + c;
+		for (int k=0;k<K;++k,s+=channels)
+			v = _mm512_fmadd_ps(_mm512_set1_ps(filt[k]),_mm512_maskz_loadu_ps(m,s),v);
+		_mm512_mask_storeu_ps(output + c,m,v);
+	}
+}
+
+SMARC_TARGET("avx2,fma")
+static double avx2_filter_folded(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int H, const int n)
+{
+	// mirrored samples are loaded backwards and reversed in register, two fma chains
+	const double* r = signal + n - 4;
+	__m256d v0 = _mm256_setzero_pd();
+	__m256d v1 = _mm256_setzero_pd();
+	for (int k=0;k<H;k+=8) {
+		const __m256d m0 = _mm256_permute4x64_pd(_mm256_loadu_pd(r - k),0x1b);
+		const __m256d m1 = _mm256_permute4x64_pd(_mm256_loadu_pd(r - k - 4),0x1b);
+		v0 = _mm256_fmadd_pd(_mm256_load_pd(filt + k),_mm256_add_pd(_mm256_loadu_pd(signal + k),m0),v0);
+		v1 = _mm256_fmadd_pd(_mm256_load_pd(filt + k + 4),_mm256_add_pd(_mm256_loadu_pd(signal + k + 4),m1),v1);
+	}
+	v0 = _mm256_add_pd(v0,v1);
+	__m128d h = _mm_add_pd(_mm256_castpd256_pd128(v0),_mm256_extractf128_pd(v0,1));
+	h = _mm_add_sd(h,_mm_unpackhi_pd(h,h));
+	return _mm_cvtsd_f64(h);
+}
+
+SMARC_TARGET("avx2,fma")
+static float avx2_filter_folded_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int H, const int n)
+{
+	const __m256i reverse = _mm256_setr_epi32(7,6,5,4,3,2,1,0);
+	const float* r = signal + n - 8;
+	__m256 v0 = _mm256_setzero_ps();
+	__m256 v1 = _mm256_setzero_ps();
+	int k=0;
+	for (;k<H-15;k+=16) {
+		const __m256 m0 = _mm256_permutevar8x32_ps(_mm256_loadu_ps(r - k),reverse);
+		const __m256 m1 = _mm256_permutevar8x32_ps(_mm256_loadu_ps(r - k - 8),reverse);
+		v0 = _mm256_fmadd_ps(_mm256_load_ps(filt + k),_mm256_add_ps(_mm256_loadu_ps(signal + k),m0),v0);
+		v1 = _mm256_fmadd_ps(_mm256_load_ps(filt + k + 8),_mm256_add_ps(_mm256_loadu_ps(signal + k + 8),m1),v1);
+	}
+	if (k<H) {
+		const __m256 m0 = _mm256_permutevar8x32_ps(_mm256_loadu_ps(r - k),reverse);
+		v0 = _mm256_fmadd_ps(_mm256_load_ps(filt + k),_mm256_add_ps(_mm256_loadu_ps(signal + k),m0),v0);
+	}
+	v0 = _mm256_add_ps(v0,v1);
+	__m128 h = _mm_add_ps(_mm256_castps256_ps128(v0),_mm256_extractf128_ps(v0,1));
+	h = _mm_add_ps(h,_mm_movehl_ps(h,h));
+	h = _mm_add_ss(h,_mm_shuffle_ps(h,h,1));
+	return _mm_cvtss_f32(h);
+}
+
+SMARC_TARGET("avx512f")
+static double avx512_filter_folded(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int H, const int n)
+{
+	const __m512i reverse = _mm512_set_epi64(0,1,2,3,4,5,6,7);
+	const double* r = signal + n - 8;
+	__m512d v0 = _mm512_setzero_pd();
+	__m512d v1 = _mm512_setzero_pd();
+	int k=0;
+	for (;k<H-15;k+=16) {
+		const __m512d m0 = _mm512_permutexvar_pd(reverse,_mm512_loadu_pd(r - k));
+		const __m512d m1 = _mm512_permutexvar_pd(reverse,_mm512_loadu_pd(r - k - 8));
+		v0 = _mm512_fmadd_pd(_mm512_load_pd(filt + k),_mm512_add_pd(_mm512_loadu_pd(signal + k),m0),v0);
+		v1 = _mm512_fmadd_pd(_mm512_load_pd(filt + k + 8),_mm512_add_pd(_mm512_loadu_pd(signal + k + 8),m1),v1);
+	}
+	if (k<H) {
+		const __m512d m0 = _mm512_permutexvar_pd(reverse,_mm512_loadu_pd(r - k));
+		v0 = _mm512_fmadd_pd(_mm512_load_pd(filt + k),_mm512_add_pd(_mm512_loadu_pd(signal + k),m0),v0);
+	}
+	return _mm512_reduce_add_pd(_mm512_add_pd(v0,v1));
+}
+
+SMARC_TARGET("avx512f")
+static float avx512_filter_folded_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int H, const int n)
+{
+	// filt is only aligned on 32 bytes and H is a multiple of 8: the last
+	// step may handle half a register, whose mirrored samples are loaded in
+	// the lower half and reversed there
+	const __m512i reverse = _mm512_set_epi32(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15);
+	const __m512i reverse_low = _mm512_set_epi32(15,14,13,12,11,10,9,8,0,1,2,3,4,5,6,7);
+	const float* r = signal + n - 16;
+	__m512 v0 = _mm512_setzero_ps();
+	__m512 v1 = _mm512_setzero_ps();
+	int k=0;
+	for (;k<H-31;k+=32) {
+		const __m512 m0 = _mm512_permutexvar_ps(reverse,_mm512_loadu_ps(r - k));
+		const __m512 m1 = _mm512_permutexvar_ps(reverse,_mm512_loadu_ps(r - k - 16));
+		v0 = _mm512_fmadd_ps(_mm512_loadu_ps(filt + k),_mm512_add_ps(_mm512_loadu_ps(signal + k),m0),v0);
+		v1 = _mm512_fmadd_ps(_mm512_loadu_ps(filt + k + 16),_mm512_add_ps(_mm512_loadu_ps(signal + k + 16),m1),v1);
+	}
+	for (;k<H-15;k+=16) {
+		const __m512 m0 = _mm512_permutexvar_ps(reverse,_mm512_loadu_ps(r - k));
+		v0 = _mm512_fmadd_ps(_mm512_loadu_ps(filt + k),_mm512_add_ps(_mm512_loadu_ps(signal + k),m0),v0);
+	}
+	if (k<H) {
+		const __mmask16 m = (__mmask16) 0xff;
+		const __m512 m0 = _mm512_permutexvar_ps(reverse_low,_mm512_maskz_loadu_ps(m,signal + n - 8 - k));
+		v1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m,filt + k),_mm512_add_ps(_mm512_maskz_loadu_ps(m,signal + k),m0),v1);
+	}
+	return _mm512_reduce_add_ps(_mm512_add_ps(v0,v1));
+}
+
+SMARC_TARGET("avx2,fma")
+static void avx2_filter_folded_multi_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int H,
+		const int n, const int channels, const int stride, float* SMARC_RESTRICT output)
+{
+	// as avx2_filter_multi_f, the two frames of a pair are added before the fma
+	int c=0;
+	for (;c<channels-15;c+=16) {
+		__m256 a0 = _mm256_setzero_ps();
+		__m256 a1 = _mm256_setzero_ps();
+		__m256 b0 = _mm256_setzero_ps();
+		__m256 b1 = _mm256_setzero_ps();
+		const float* s = signal + c;
+		const float* r = signal + (size_t)(n-1)*stride + c;
+		int k=0;
+		for (;k<H-1;k+=2,s+=2*stride,r-=2*stride) {
+			const __m256 f = _mm256_set1_ps(filt[k]);
+			const __m256 g = _mm256_set1_ps(filt[k+1]);
+			a0 = _mm256_fmadd_ps(f,_mm256_add_ps(_mm256_loadu_ps(s),_mm256_loadu_ps(r)),a0);
+			a1 = _mm256_fmadd_ps(f,_mm256_add_ps(_mm256_loadu_ps(s + 8),_mm256_loadu_ps(r + 8)),a1);
+			b0 = _mm256_fmadd_ps(g,_mm256_add_ps(_mm256_loadu_ps(s + stride),_mm256_loadu_ps(r - stride)),b0);
+			b1 = _mm256_fmadd_ps(g,_mm256_add_ps(_mm256_loadu_ps(s + stride + 8),_mm256_loadu_ps(r - stride + 8)),b1);
+		}
+		if (k<H) {
+			const __m256 f = _mm256_set1_ps(filt[k]);
+			a0 = _mm256_fmadd_ps(f,_mm256_add_ps(_mm256_loadu_ps(s),_mm256_loadu_ps(r)),a0);
+			a1 = _mm256_fmadd_ps(f,_mm256_add_ps(_mm256_loadu_ps(s + 8),_mm256_loadu_ps(r + 8)),a1);
+		}
+		_mm256_storeu_ps(output + c,_mm256_add_ps(a0,b0));
+		_mm256_storeu_ps(output + c + 8,_mm256_add_ps(a1,b1));
+	}
+	for (;c<channels-7;c+=8) {
+		__m256 v = _mm256_setzero_ps();
+		const float* s = signal + c;
+		const float* r = signal + (size_t)(n-1)*stride + c;
+		for (int k=0;k<H;++k,s+=stride,r-=stride)
+			v = _mm256_fmadd_ps(_mm256_set1_ps(filt[k]),_mm256_add_ps(_mm256_loadu_ps(s),_mm256_loadu_ps(r)),v);
+		_mm256_storeu_ps(output + c,v);
+	}
+	for (;c<channels;++c)
+		output[c] = strided_folded_f(filt,signal+c,H,n,stride);
+}
+
+SMARC_TARGET("avx512f")
+static void avx512_filter_folded_multi_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int H,
+		const int n, const int channels, const int stride, float* SMARC_RESTRICT output)
+{
+	// as avx512_filter_multi_f, the two frames of a pair are added before the fma
+	int c=0;
+	for (;c<channels-31;c+=32) {
+		__m512 a0 = _mm512_setzero_ps();
+		__m512 a1 = _mm512_setzero_ps();
+		__m512 b0 = _mm512_setzero_ps();
+		__m512 b1 = _mm512_setzero_ps();
+		const float* s = signal + c;
+		const float* r = signal + (size_t)(n-1)*stride + c;
+		int k=0;
+		for (;k<H-1;k+=2,s+=2*stride,r-=2*stride) {
+			const __m512 f = _mm512_set1_ps(filt[k]);
+			const __m512 g = _mm512_set1_ps(filt[k+1]);
+			a0 = _mm512_fmadd_ps(f,_mm512_add_ps(_mm512_loadu_ps(s),_mm512_loadu_ps(r)),a0);
+			a1 = _mm512_fmadd_ps(f,_mm512_add_ps(_mm512_loadu_ps(s + 16),_mm512_loadu_ps(r + 16)),a1);
+			b0 = _mm512_fmadd_ps(g,_mm512_add_ps(_mm512_loadu_ps(s + stride),_mm512_loadu_ps(r - stride)),b0);
+			b1 = _mm512_fmadd_ps(g,_mm512_add_ps(_mm512_loadu_ps(s + stride + 16),_mm512_loadu_ps(r - stride + 16)),b1);
+		}
+		if (k<H) {
+			const __m512 f = _mm512_set1_ps(filt[k]);
+			a0 = _mm512_fmadd_ps(f,_mm512_add_ps(_mm512_loadu_ps(s),_mm512_loadu_ps(r)),a0);
+			a1 = _mm512_fmadd_ps(f,_mm512_add_ps(_mm512_loadu_ps(s + 16),_mm512_loadu_ps(r + 16)),a1);
+		}
+		_mm512_storeu_ps(output + c,_mm512_add_ps(a0,b0));
+		_mm512_storeu_ps(output + c + 16,_mm512_add_ps(a1,b1));
+	}
+	for (;c<channels;c+=16) {
+		const int n_c = channels-c<16 ? channels-c : 16;
+		const __mmask16 m = (__mmask16) ((1u << n_c) - 1);
+		__m512 v = _mm512_setzero_ps();
+		const float* s = signal + c;
+		const float* r = signal + (size_t)(n-1)*stride + c;
+		for (int k=0;k<H;++k,s+=stride,r-=stride)
+			v = _mm512_fmadd_ps(_mm512_set1_ps(filt[k]),_mm512_add_ps(_mm512_maskz_loadu_ps(m,s),_mm512_maskz_loadu_ps(m,r)),v);
+		_mm512_mask_storeu_ps(output + c,m,v);
+	}
+}
+
+#define AVX2_FIXED_KERNELS(isa,K) FIXED_KERNELS(SMARC_TARGET("avx2,fma"),isa,K)
+#define AVX512_FIXED_KERNELS(isa,K) FIXED_KERNELS(SMARC_TARGET("avx512f"),isa,K)
+SMARC_FIXED_LENGTHS(AVX2_FIXED_KERNELS,avx2)
+SMARC_FIXED_LENGTHS(AVX512_FIXED_KERNELS,avx512)
+
+enum { CPU_DEFAULT, CPU_AVX2_FMA, CPU_AVX512F };
+
+static int cpu_level(void)
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info,0);
+	if (info[0]<7)
+		return CPU_DEFAULT;
+	__cpuid(info,1);
+	const int fma = (info[2] >> 12) & 1;
+	const int osxsave = (info[2] >> 27) & 1;
+	if (!osxsave)
+		return CPU_DEFAULT;
+	// the OS must save the ymm (and zmm) registers on context switches
+	const unsigned long long xcr0 = _xgetbv(0);
+	if ((xcr0 & 0x6) != 0x6)
+		return CPU_DEFAULT;
+	__cpuidex(info,7,0);
+	if (((info[1] >> 16) & 1) && (xcr0 & 0xe6) == 0xe6)
+		return CPU_AVX512F;
+	if (((info[1] >> 5) & 1) && fma)
+		return CPU_AVX2_FMA;
+	return CPU_DEFAULT;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return CPU_AVX512F;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return CPU_AVX2_FMA;
+	return CPU_DEFAULT;
+#endif
+}
+
+typedef void (*FilterMultiFuncF)(const float* SMARC_RESTRICT, const float* SMARC_RESTRICT, const int,
+		const int, float* SMARC_RESTRICT);
+typedef double (*FoldedFunc)(const double* SMARC_RESTRICT, const double* SMARC_RESTRICT, const int, const int);
+typedef float (*FoldedFuncF)(const float* SMARC_RESTRICT, const float* SMARC_RESTRICT, const int, const int);
+typedef void (*FoldedMultiFuncF)(const float* SMARC_RESTRICT, const float* SMARC_RESTRICT, const int, const int,
+		const int, const int, float* SMARC_RESTRICT);
+
+// kernels in use. They start as the kernels every x86 CPU runs and are
+// replaced by the best ones for the CPU by select_filters, which runs once
+// when the library is loaded, before any thread can call them. cpu is the
+// level they were chosen for.
+static int cpu = CPU_DEFAULT;
+static FilterFunc filter_impl = default_filter;
+static FilterFuncF filter_f_impl = default_filter_f;
+static FilterMultiFuncF filter_multi_f_impl = default_filter_multi_f;
+static FilterFunc filter_padded_impl = default_filter_padded;
+static FilterFuncF filter_padded_f_impl = default_filter_padded_f;
+static FoldedFunc filter_folded_impl = default_filter_folded;
+static FoldedFuncF filter_folded_f_impl = default_filter_folded_f;
+static FoldedMultiFuncF filter_folded_multi_f_impl = default_filter_folded_multi_f;
+
+#ifdef _MSC_VER
+static void select_filters(void);
+#pragma section(".CRT$XCU",read)
+__declspec(allocate(".CRT$XCU")) static void (*select_filters_at_load)(void) = select_filters;
+#else
+__attribute__((constructor))
+#endif
+static void select_filters(void)
+{
+	cpu = cpu_level();
+	switch (cpu) {
+	case CPU_AVX512F:
+		filter_impl = avx512_filter;
+		filter_f_impl = avx512_filter_f;
+		filter_multi_f_impl = avx512_filter_multi_f;
+		filter_padded_impl = avx512_filter_padded;
+		filter_padded_f_impl = avx512_filter_padded_f;
+		filter_folded_impl = avx512_filter_folded;
+		filter_folded_f_impl = avx512_filter_folded_f;
+		filter_folded_multi_f_impl = avx512_filter_folded_multi_f;
+		break;
+	case CPU_AVX2_FMA:
+		filter_impl = avx2_filter;
+		filter_f_impl = avx2_filter_f;
+		filter_multi_f_impl = avx2_filter_multi_f;
+		filter_padded_impl = avx2_filter_padded;
+		filter_padded_f_impl = avx2_filter_padded_f;
+		filter_folded_impl = avx2_filter_folded;
+		filter_folded_f_impl = avx2_filter_folded_f;
+		filter_folded_multi_f_impl = avx2_filter_folded_multi_f;
+		break;
+	default:
+		filter_impl = default_filter;
+		filter_f_impl = default_filter_f;
+		filter_multi_f_impl = default_filter_multi_f;
+		filter_padded_impl = default_filter_padded;
+		filter_padded_f_impl = default_filter_padded_f;
+		filter_folded_impl = default_filter_folded;
+		filter_folded_f_impl = default_filter_folded_f;
+		filter_folded_multi_f_impl = default_filter_folded_multi_f;
+		break;
+	}
+}
+
+double filter(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int K)
+{
+	return filter_impl(filt,signal,K);
+}
+
+float filter_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int K)
+{
+	return filter_f_impl(filt,signal,K);
+}
+
+void filter_multi_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int K,
+		const int channels, float* SMARC_RESTRICT output)
+{
+	filter_multi_f_impl(filt,signal,K,channels,output);
+}
+
+double filter_padded(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int K)
+{
+	return filter_padded_impl(filt,signal,K);
+}
+
+float filter_padded_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int K)
+{
+	return filter_padded_f_impl(filt,signal,K);
+}
+
+double filter_folded(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int H, const int n)
+{
+	return filter_folded_impl(filt,signal,H,n);
+}
+
+float filter_folded_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int H, const int n)
+{
+	return filter_folded_f_impl(filt,signal,H,n);
+}
+
+void filter_folded_multi_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int H, const int n,
+		const int channels, const int stride, float* SMARC_RESTRICT output)
+{
+	filter_folded_multi_f_impl(filt,signal,H,n,channels,stride,output);
+}
+
+FilterFunc filter_padded_kernel(const int K)
+{
+	switch (cpu) {
+	case CPU_AVX512F:
+		switch (K) {
+		SMARC_FIXED_LENGTHS(FIXED_CASE,avx512)
+		}
+		return avx512_filter_padded;
+	case CPU_AVX2_FMA:
+		switch (K) {
+		SMARC_FIXED_LENGTHS(FIXED_CASE,avx2)
+		}
+		return avx2_filter_padded;
+	default:
+		switch (K) {
+		SMARC_FIXED_LENGTHS(FIXED_CASE,DEFAULT_ISA)
+		}
+		return default_filter_padded;
+	}
+}
+
+FilterFuncF filter_padded_kernel_f(const int K)
+{
+	switch (cpu) {
+	case CPU_AVX512F:
+		switch (K) {
+		SMARC_FIXED_LENGTHS(FIXED_CASE_F,avx512)
+		}
+		return avx512_filter_padded_f;
+	case CPU_AVX2_FMA:
+		switch (K) {
+		SMARC_FIXED_LENGTHS(FIXED_CASE_F,avx2)
+		}
+		return avx2_filter_padded_f;
+	default:
+		switch (K) {
+		SMARC_FIXED_LENGTHS(FIXED_CASE_F,DEFAULT_ISA)
+		}
+		return default_filter_padded_f;
+	}
+}
+
+#endif
 
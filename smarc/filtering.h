@@ -31,6 +31,67 @@
 #define SMARC_RESTRICT restrict
 #endif
 
+#include <stddef.h>
+
+/**
+ * Alignment in bytes of filter allocations, and length multiple of padded filters
+ */
+#define SMARC_FILTER_ALIGN 64
+#define SMARC_FILTER_PAD 8
+
 double filter(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int K);
+float filter_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int K);
+
+/**
+ * Same as filter and filter_f for padded filters: K is a multiple of
+ * SMARC_FILTER_PAD and filt is aligned on SMARC_FILTER_PAD samples (the
+ * phases of a filter allocated with smarc_aligned_malloc), so that
+ * coefficients are loaded aligned and no scalar tail is left.
+ */
+double filter_padded(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int K);
+float filter_padded_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int K);
+
+typedef double (*FilterFunc)(const double* SMARC_RESTRICT, const double* SMARC_RESTRICT, const int);
+typedef float (*FilterFuncF)(const float* SMARC_RESTRICT, const float* SMARC_RESTRICT, const int);
+
+/**
+ * Kernel computing filter_padded (filter_padded_f) on this CPU for padded
+ * filters of K taps. Short lengths frequent in stage filters have kernels
+ * unrolled for their K, which ignore the K argument. To be looked up once
+ * per filter.
+ */
+FilterFunc filter_padded_kernel(const int K);
+FilterFuncF filter_padded_kernel_f(const int K);
+
+/**
+ * Symmetric filters of n taps (h[k] == h[n-1-k]), folded so that each pair
+ * of mirrored samples is added before a single multiply:
+ * output = sum_k filt[k] * (signal[k] + signal[n-1-k]) for k < H.
+ * filt holds the first (n+1)/2 coefficients, the center one halved when n is
+ * odd, followed by zeros up to H, a multiple of SMARC_FILTER_PAD not above n.
+ * filt is aligned as for filter_padded.
+ */
+double filter_folded(const double* SMARC_RESTRICT filt, const double* SMARC_RESTRICT signal, const int H, const int n);
+float filter_folded_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int H, const int n);
+
+/**
+ * Filters interleaved channels: output[c] = sum_k filt[k] * signal[k*channels + c]
+ */
+void filter_multi_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int K,
+		const int channels, float* SMARC_RESTRICT output);
+
+/**
+ * Same as filter_folded_f for interleaved channels, H need not be padded.
+ * Frames are stride samples apart in signal (channels for consecutive frames,
+ * 2*channels for every other one).
+ */
+void filter_folded_multi_f(const float* SMARC_RESTRICT filt, const float* SMARC_RESTRICT signal, const int H, const int n,
+		const int channels, const int stride, float* SMARC_RESTRICT output);
+
+/**
+ * Allocate size bytes aligned on SMARC_FILTER_ALIGN bytes, to be released with smarc_aligned_free
+ */
+void* smarc_aligned_malloc(size_t size);
+void smarc_aligned_free(void* ptr);
 
 #endif /* FILTER_H_ */
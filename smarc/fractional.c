@@ -0,0 +1,291 @@
+/**
+ * Smarc
+ *
+ * Fractional-ratio resampler, added to the copy of Smarc bundled with libxdf.
+ *
+ * This file is part of Smarc.
+ *
+ * Smarc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Smarc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "smarc.h"
+#include "filtering.h"
+#include "stage_impl.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// input frames buffered per FState, on top of the filter length
+#define FRACTIONAL_BLOCK_SIZE 4096
+// largest phase table, in coefficients
+#define MAX_PHASE_TABLE_SIZE (1 << 24)
+
+/**
+ * FFilter is a Kaiser windowed sinc sampled at P phases per input sample.
+ * The coefficients of a fractional position are linearly interpolated
+ * between the two nearest phases (a first order Farrow structure), which
+ * costs two dot products per output.
+ * - coefs: (P+1)*K coefficients, phase p holds h(p/P + K/2 - 1 - k) for k in [0,K)
+ * - diffs: P*K differences between successive phases
+ */
+struct FFilter
+{
+	double fsin;
+	double fsout;
+	double step; // input samples per output sample
+	int K;
+	int P;
+	float* coefs;
+	float* diffs;
+};
+
+/**
+ * FState holds the input history of a fractional resampling.
+ * buf[0] holds input frame `base`, frames before 0 are zeros.
+ */
+struct FState
+{
+	int channels;
+	float* buf;
+	int capacity; // in frames
+	int count; // frames held
+	long long base;
+	double start; // input position of output 0
+	long long nbIn; // input frames received
+	long long nbOut; // output frames produced
+	int flushing;
+	float* tmp; // 2*channels partial sums
+};
+
+struct FFilter* smarc_init_ffilter(double fsin, double fsout, double bandwidth, double rs)
+{
+	if (fsin<=0 || fsout<=0 || bandwidth<=0 || bandwidth>=1 || rs<=0)
+	{
+		printf("ERROR: invalid parameters for fractional resampler !\n");
+		return NULL;
+	}
+
+	// band edges in cycles per input sample
+	const double fstop = 0.5 * (fsin<fsout ? fsin : fsout) / fsin;
+	const double fpass = bandwidth * fstop;
+	const double fc = 0.5 * (fpass + fstop);
+
+	// Kaiser window design
+	const double beta = kaiser_beta(rs);
+	int K = (int) ceil((rs-7.95) / (14.36*(fstop-fpass)));
+	if (K<4)
+		K = 4;
+	K += K%2;
+
+	// linear interpolation between phases is accurate to (pi*fc/P)^2/2
+	int P = 16;
+	while (P<4096 && M_PI*fc/P > sqrt(2.0*pow(10,-rs/20.0)))
+		P *= 2;
+	while (P>16 && (size_t)(P+1)*K > MAX_PHASE_TABLE_SIZE)
+		P /= 2;
+	if ((size_t)(P+1)*K > MAX_PHASE_TABLE_SIZE)
+	{
+		printf("ERROR: fractional resampler filter too long (%i taps) ! try to decrease bandwidth.\n",K);
+		return NULL;
+	}
+
+	struct FFilter* ffilt = malloc(sizeof(struct FFilter));
+	ffilt->fsin = fsin;
+	ffilt->fsout = fsout;
+	ffilt->step = fsin / fsout;
+	ffilt->K = K;
+	ffilt->P = P;
+	ffilt->coefs = malloc((size_t)(P+1)*K*sizeof(float));
+	ffilt->diffs = malloc((size_t)P*K*sizeof(float));
+
+	const int half = K/2;
+	const double i0beta = bessel_i0(beta);
+	double* h = malloc(K*sizeof(double));
+	for (int p=0;p<=P;p++) {
+		double sum = 0;
+		for (int k=0;k<K;k++) {
+			const double x = (double)p/P + half - 1 - k;
+			const double r = x/half;
+			double v = 0;
+			if (r>-1 && r<1) {
+				v = x==0 ? 2*fc : sin(2*M_PI*fc*x) / (M_PI*x);
+				v *= bessel_i0(beta*sqrt(1-r*r)) / i0beta;
+			}
+			h[k] = v;
+			sum += v;
+		}
+		// unit gain at DC for every phase
+		for (int k=0;k<K;k++)
+			ffilt->coefs[(size_t)p*K+k] = (float) (h[k]/sum);
+	}
+	free(h);
+	for (size_t i=0;i<(size_t)P*K;i++)
+		ffilt->diffs[i] = ffilt->coefs[i+K] - ffilt->coefs[i];
+
+	return ffilt;
+}
+
+void smarc_destroy_ffilter(struct FFilter* ffilt)
+{
+	if (ffilt) {
+		free(ffilt->coefs);
+		free(ffilt->diffs);
+		free(ffilt);
+	}
+}
+
+int smarc_get_foutput_buffer_size(struct FFilter* ffilt, int inSize)
+{
+	return 2 + (int) ceil(inSize / ffilt->step);
+}
+
+struct FState* smarc_init_fstate(struct FFilter* ffilt, int channels)
+{
+	if (channels<1)
+		return NULL;
+	struct FState* fstate = malloc(sizeof(struct FState));
+	fstate->channels = channels;
+	fstate->capacity = ffilt->K + FRACTIONAL_BLOCK_SIZE;
+	fstate->buf = malloc((size_t)fstate->capacity*channels*sizeof(float));
+	fstate->tmp = malloc(2*channels*sizeof(float));
+	smarc_reset_fstate(fstate,ffilt);
+	return fstate;
+}
+
+void smarc_destroy_fstate(struct FState* fstate)
+{
+	if (fstate) {
+		free(fstate->buf);
+		free(fstate->tmp);
+		free(fstate);
+	}
+}
+
+void smarc_reset_fstate(struct FState* fstate, struct FFilter* ffilt)
+{
+	// output 0 is at input 0: its window starts K/2-1 zeros before the signal
+	fstate->count = ffilt->K/2 - 1;
+	fstate->base = -fstate->count;
+	memset(fstate->buf,0,(size_t)fstate->count*fstate->channels*sizeof(float));
+	fstate->start = 0;
+	fstate->nbIn = 0;
+	fstate->nbOut = 0;
+	fstate->flushing = 0;
+}
+
+void smarc_set_fstate_start(struct FState* fstate, double start)
+{
+	// windows of outputs at or after input 0 start within the zeros of reset
+	fstate->start = start>0 ? start : 0;
+}
+
+// compute outputs whose window is in the buffer, up to the end of the signal
+static int fresample_available(struct FFilter* ffilt, struct FState* fstate, float* output, int outputFrames)
+{
+	const int K = ffilt->K;
+	const int half = K/2;
+	const int C = fstate->channels;
+	const long long end = fstate->base + fstate->count;
+	int nbWritten = 0;
+	while (nbWritten<outputFrames) {
+		// exact position of the output in input frames, no accumulated rounding
+		const double t = fstate->start + fstate->nbOut * ffilt->step;
+		if (fstate->flushing && t>=fstate->nbIn)
+			break;
+		const long long i0 = (long long) floor(t);
+		if (i0+half>=end)
+			break;
+		const double phase = (t-i0) * ffilt->P;
+		int p = (int) phase;
+		if (p>=ffilt->P)
+			p = ffilt->P-1;
+		const float mu = (float) (phase-p);
+		const float* coefs = ffilt->coefs + (size_t)p*K;
+		const float* diffs = ffilt->diffs + (size_t)p*K;
+		const float* x = fstate->buf + (size_t)(i0-half+1-fstate->base)*C;
+		float* out = output + (size_t)nbWritten*C;
+		if (C==1) {
+			out[0] = filter_f(coefs,x,K) + mu*filter_f(diffs,x,K);
+		} else {
+			filter_multi_f(coefs,x,K,C,fstate->tmp);
+			filter_multi_f(diffs,x,K,C,fstate->tmp+C);
+			for (int c=0;c<C;c++)
+				out[c] = fstate->tmp[c] + mu*fstate->tmp[C+c];
+		}
+		fstate->nbOut++;
+		nbWritten++;
+	}
+	return nbWritten;
+}
+
+// drop the frames no window will use anymore
+static void fresample_discard(struct FFilter* ffilt, struct FState* fstate)
+{
+	const long long first = (long long) floor(fstate->start + fstate->nbOut * ffilt->step) - ffilt->K/2 + 1;
+	long long n = first - fstate->base;
+	if (n<=0)
+		return;
+	if (n>fstate->count)
+		n = fstate->count;
+	const size_t frame = fstate->channels*sizeof(float);
+	memmove(fstate->buf,fstate->buf + (size_t)n*fstate->channels,(size_t)(fstate->count-n)*frame);
+	fstate->count -= (int) n;
+	fstate->base += n;
+}
+
+int smarc_fresample_f(struct FFilter* ffilt, struct FState* fstate,
+		const float* signal,
+		int signalFrames,
+		float* output,
+		int outputFrames)
+{
+	const int C = fstate->channels;
+	int nbRead = 0;
+	int nbWritten = 0;
+	while (nbRead<signalFrames && nbWritten<outputFrames) {
+		fresample_discard(ffilt,fstate);
+		int toRead = fstate->capacity - fstate->count;
+		if (toRead>signalFrames-nbRead)
+			toRead = signalFrames-nbRead;
+		memcpy(fstate->buf + (size_t)fstate->count*C,signal + (size_t)nbRead*C,(size_t)toRead*C*sizeof(float));
+		fstate->count += toRead;
+		fstate->nbIn += toRead;
+		nbRead += toRead;
+		nbWritten += fresample_available(ffilt,fstate,output + (size_t)nbWritten*C,outputFrames-nbWritten);
+	}
+	if (nbRead<signalFrames)
+		printf("WARNING: cannot write all output samples, please provide larger output buffer !");
+	return nbWritten;
+}
+
+int smarc_fresample_flush_f(struct FFilter* ffilt, struct FState* fstate,
+		float* output,
+		int outputFrames)
+{
+	if (!fstate->flushing) {
+		// the signal ends with zeros
+		fresample_discard(ffilt,fstate);
+		const int n = ffilt->K/2;
+		memset(fstate->buf + (size_t)fstate->count*fstate->channels,0,(size_t)n*fstate->channels*sizeof(float));
+		fstate->count += n;
+		fstate->flushing = 1;
+	}
+	return fresample_available(ffilt,fstate,output,outputFrames);
+}
@@ -52,8 +52,9 @@ struct PPredef {
 	char* def;
 };
 
-static const int s_predefs_size = 40;
-// less operations
+static const int s_predefs_size = 59;
+// less operations. Biosignal rates (250, 500, 1000, 2000 Hz against powers of 2)
+// also keep every stage filter at most about 1100 taps long, so that they design quickly
 static const struct PPredef s_predefs[] = {
         { 1, 4, "2/1 2/1"},
 		{ 1, 6, "2/1 3/1"},
@@ -70,10 +71,24 @@ static const struct PPredef s_predefs[] = {
 		{ 8, 3, "1/2 3/4"},
 		{ 12, 1, "1/2 1/2 1/3"},
 		{ 16, 1, "1/2 1/2 1/2 1/2"},
+		{ 16, 125, "5/4 5/2 5/2"},
 		{ 24, 1, "1/2 1/2 1/2 1/3"},
+		{ 32, 1, "1/4 1/4 1/2"},
+		{ 32, 125, "5/4 5/4 5/2"},
 		{ 40, 147, "1/2 3/2 7/2 7/5"},
+		{ 64, 125, "5/4 5/4 5/4"},
 		{ 80, 147, "7/5 7/4 3/2 1/2"},
 		{ 80, 441, "3/2 3/2 7/4 7/5"},
+		{ 125, 16, "4/5 4/5 2/5 1/2"},
+		{ 125, 32, "4/5 4/5 2/5"},
+		{ 125, 64, "4/5 4/5 4/5"},
+		{ 125, 128, "2/1 4/5 4/5 4/5"},
+		{ 125, 256, "2/1 2/1 4/5 4/5 4/5"},
+		{ 125, 512, "2/1 16/5 4/5 4/5"},
+		{ 125, 1024, "2/1 2/1 16/5 4/5 4/5"},
+		{ 125, 2048, "2/1 16/5 16/5 4/5"},
+		{ 125, 4096, "2/1 2/1 16/5 16/5 4/5"},
+		{ 128, 125, "5/4 5/4 5/4 1/2"},
 		{ 147, 40, "2/1 2/3 2/7 5/7"},
 		{ 147, 80, "5/7 4/7 2/3 2/1"},
 		{ 147, 160, "4/7 2/1 4/3 5/7"},
@@ -83,6 +98,7 @@ static const struct PPredef s_predefs[] = {
 		{ 147, 2560, "2/1 4/1 4/1 4/7 4/3 5/7"},
 		{ 160, 147, "7/5 3/4 1/2 7/4"},
 		{ 160, 441, "7/5 7/4 3/2 3/2 1/2"},
+		{ 256, 125, "5/4 5/4 5/4 1/2 1/2"},
 		{ 320, 147, "7/4 1/4 3/4 7/5"},
 		{ 320, 441, "3/4 3/4 7/4 7/5"},
 		{ 441, 80, "2/3 2/3 4/7 5/7"},
@@ -90,11 +106,15 @@ static const struct PPredef s_predefs[] = {
 		{ 441, 320, "4/7 4/3 4/3 5/7"},
 		{ 441, 640, "2/1 4/7 4/3 4/3 5/7"},
 		{ 441, 1280, "4/1 4/7 4/3 4/3 5/7"},
+		{ 512, 125, "5/4 5/4 5/16 1/2"},
 		{ 640, 147, "1/2 1/4 7/4 3/4 7/5"},
 		{ 640, 441, "1/2 7/4 3/4 3/4 7/5"},
+		{ 1024, 125, "5/4 5/4 5/16 1/2 1/2"},
 		{ 1280, 147, "1/4 1/4 7/4 3/4 7/5"},
 		{ 1280, 441, "1/4 7/4 3/4 3/4 7/5"},
-		{ 2560, 147, "1/2 1/4 1/4 7/4 3/4 7/5"}
+		{ 2048, 125, "5/4 5/16 5/16 1/2"},
+		{ 2560, 147, "1/2 1/4 1/4 7/4 3/4 7/5"},
+		{ 4096, 125, "5/4 5/16 5/16 1/2 1/2"}
 };
 
 void destroy_multistagedef(struct PMultiStageDef* pdef) {
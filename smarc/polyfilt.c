@@ -55,7 +55,7 @@ void polyfiltLM(struct PSFilter* pfilt, struct PSState* pstate,
 	while ((signalPos+K<=signalLen) && (outPos<outputLen))
 	{
 		// compute value
-		output[outPos++] = filter(pfilt->filters + phase*K,signal + signalPos, K);
+		output[outPos++] = pfilt->kernel(pfilt->filters + phase*K,signal + signalPos, K);
 
 		// consume samples
 		phase += M;
@@ -95,7 +95,7 @@ void polyfiltM(struct PSFilter* pfilt, struct PSState* pstate,
 //		for (int k=0;k<K;k++)
 //			v += inPtr[k] * filt[k];
 //		output[outPos++] = v;
-		output[outPos++] = filter(filt,signal+signalPos,K);
+		output[outPos++] = pfilt->kernel(filt,signal+signalPos,K);
 
 		// consume samples
 		signalPos += M;
@@ -135,7 +135,7 @@ void polyfiltL(struct PSFilter* pfilt, struct PSState* pstate,
 //		for (int k=0;k<K;++k)
 //			v += inPtr[k] * filtPtr[k];
 //		output[outPos++] = v;
-		output[outPos++] = filter(pfilt->filters + phase*K, signal+signalPos, K);
+		output[outPos++] = pfilt->kernel(pfilt->filters + phase*K, signal+signalPos, K);
 		phase++;
 		if (phase==L) {
 			signalPos++;
@@ -148,3 +148,472 @@ void polyfiltL(struct PSFilter* pfilt, struct PSState* pstate,
 	*nbRead = signalPos;
 	*nbWritten = outPos;
 }
+
+void polyfiltLM_f(struct PSFilter* pfilt, struct PSState* pstate,
+		const float* signal, int signalLen, int* nbRead, float* output,
+		int outputLen, int* nbWritten) {
+	const int M = pfilt->M;
+	const int L = pfilt->L;
+	const int K = pfilt->K;
+
+	int signalPos = 0;
+	int outPos = 0;
+	int phase = pstate->phase;
+
+	// skip first sample for delays
+	if (pstate->skip>0)
+	{
+		const int maxAdvance = (M + L - 1) / L;
+		while (pstate->skip>0 && ((signalPos+maxAdvance)<signalLen)) {
+			pstate->skip--;
+			phase += M;
+			signalPos += phase / L;
+			phase = phase % L;
+		}
+	}
+
+	// process filtering
+	while ((signalPos+K<=signalLen) && (outPos<outputLen))
+	{
+		// compute value
+		output[outPos++] = pfilt->kernel_f(pfilt->filters_f + phase*K,signal + signalPos, K);
+
+		// consume samples
+		phase += M;
+		signalPos += phase / L;
+		phase = phase % L;
+	}
+
+	// report state values
+	pstate->phase = phase;
+	*nbRead = signalPos;
+	*nbWritten = outPos;
+}
+
+void polyfiltLM_multi_f(struct PSFilter* pfilt, struct PSState* pstate,
+		const float* signal, int signalLen, int* nbRead, float* output,
+		int outputLen, int* nbWritten, const int channels) {
+	const int M = pfilt->M;
+	const int L = pfilt->L;
+	const int K = pfilt->K;
+	const int lead = pfilt->lead;
+
+	int signalPos = 0;
+	int outPos = 0;
+	int phase = pstate->phase;
+
+	// skip first sample for delays
+	if (pstate->skip>0)
+	{
+		const int maxAdvance = (M + L - 1) / L;
+		while (pstate->skip>0 && ((signalPos+maxAdvance)<signalLen)) {
+			pstate->skip--;
+			phase += M;
+			signalPos += phase / L;
+			phase = phase % L;
+		}
+	}
+
+	// process filtering, all channels of a frame at once
+	while ((signalPos+K<=signalLen) && (outPos<outputLen))
+	{
+		// compute value
+		// the zeros padding each phase would cost a pass over all channels each, skip them
+		filter_multi_f(pfilt->filters_f + phase*K + lead, signal + (size_t)(signalPos + lead)*channels, K - lead, channels,
+				output + (size_t)outPos*channels);
+		outPos++;
+
+		// consume samples
+		phase += M;
+		signalPos += phase / L;
+		phase = phase % L;
+	}
+
+	// report state values
+	pstate->phase = phase;
+	*nbRead = signalPos;
+	*nbWritten = outPos;
+}
+
+// half-band decimation gathers the input of at most HALFBAND_BLOCK outputs at once
+#define HALFBAND_BLOCK 1024
+
+// skip first samples of a half-band stage for delays, returns the signal position reached
+static int halfband_skip(struct PSFilter* pfilt, struct PSState* pstate, int signalLen, int* phase) {
+	int signalPos = 0;
+	const int maxAdvance = (pfilt->M + pfilt->L - 1) / pfilt->L;
+	while (pstate->skip>0 && ((signalPos+maxAdvance)<signalLen)) {
+		pstate->skip--;
+		*phase += pfilt->M;
+		signalPos += *phase / pfilt->L;
+		*phase = *phase % pfilt->L;
+	}
+	return signalPos;
+}
+
+// half-band decimation workspace: gathered samples of a block, followed by the
+// zeros the padded coefficients meet
+static void* halfband_work(struct PSState* pstate, const struct PHalfBand* hb, size_t frame_size) {
+	if (pstate->hb_work==NULL)
+		pstate->hb_work = smarc_aligned_malloc((HALFBAND_BLOCK + hb->K)*frame_size);
+	return pstate->hb_work;
+}
+
+// number of outputs of the next half-band decimation block
+static int halfband_block(int signalPos, int signalLen, int K, int outputLeft) {
+	int nb = (signalLen - signalPos - K) / 2 + 1;
+	if (nb>outputLeft)
+		nb = outputLeft;
+	return nb<HALFBAND_BLOCK ? nb : HALFBAND_BLOCK;
+}
+
+void polyfiltHB(struct PSFilter* pfilt, struct PSState* pstate,
+		const double* signal, int signalLen, int* nbRead, double* output,
+		int outputLen, int* nbWritten) {
+	const struct PHalfBand* hb = pfilt->halfband;
+	const int K = pfilt->K;
+
+	int outPos = 0;
+	int phase = pstate->phase;
+	int signalPos = halfband_skip(pfilt,pstate,signalLen,&phase);
+
+	if (pfilt->L==2) {
+		while (signalPos+K<=signalLen && outPos<outputLen)
+		{
+			if (phase==hb->phase)
+				output[outPos++] = hb->center * signal[signalPos + hb->pos];
+			else if (hb->H)
+				output[outPos++] = filter_folded(hb->fold, signal+signalPos+hb->first, hb->H, hb->n);
+			else
+				output[outPos++] = pfilt->kernel(pfilt->filters + phase*K, signal+signalPos, K);
+			phase++;
+			if (phase==2) {
+				signalPos++;
+				phase=0;
+			}
+		}
+	} else {
+		double* s = halfband_work(pstate,hb,sizeof(double));
+		while (signalPos+K<=signalLen && outPos<outputLen)
+		{
+			const int nb = halfband_block(signalPos,signalLen,K,outputLen-outPos);
+			const double* x = signal + signalPos;
+			for (int i=0;i<nb+hb->n-1;i++)
+				s[i] = x[hb->first + 2*i];
+			for (int i=nb+hb->n-1;i<nb+hb->K-1;i++)
+				s[i] = 0.0;
+			if (hb->H)
+				for (int i=0;i<nb;i++)
+					output[outPos+i] = hb->center * x[2*i + hb->pos] + filter_folded(hb->fold, s+i, hb->H, hb->n);
+			else
+				for (int i=0;i<nb;i++)
+					output[outPos+i] = hb->center * x[2*i + hb->pos] + hb->kernel(hb->taps, s+i, hb->K);
+			signalPos += 2*nb;
+			outPos += nb;
+		}
+	}
+
+	// report state values
+	pstate->phase = phase;
+	*nbRead = signalPos;
+	*nbWritten = outPos;
+}
+
+void polyfiltHB_f(struct PSFilter* pfilt, struct PSState* pstate,
+		const float* signal, int signalLen, int* nbRead, float* output,
+		int outputLen, int* nbWritten) {
+	const struct PHalfBand* hb = pfilt->halfband;
+	const int K = pfilt->K;
+	const float center = (float) hb->center;
+
+	int outPos = 0;
+	int phase = pstate->phase;
+	int signalPos = halfband_skip(pfilt,pstate,signalLen,&phase);
+
+	if (pfilt->L==2) {
+		while (signalPos+K<=signalLen && outPos<outputLen)
+		{
+			if (phase==hb->phase)
+				output[outPos++] = center * signal[signalPos + hb->pos];
+			else if (hb->H)
+				output[outPos++] = filter_folded_f(hb->fold_f, signal+signalPos+hb->first, hb->H, hb->n);
+			else
+				output[outPos++] = pfilt->kernel_f(pfilt->filters_f + phase*K, signal+signalPos, K);
+			phase++;
+			if (phase==2) {
+				signalPos++;
+				phase=0;
+			}
+		}
+	} else {
+		float* s = halfband_work(pstate,hb,sizeof(float));
+		while (signalPos+K<=signalLen && outPos<outputLen)
+		{
+			const int nb = halfband_block(signalPos,signalLen,K,outputLen-outPos);
+			const float* x = signal + signalPos;
+			for (int i=0;i<nb+hb->n-1;i++)
+				s[i] = x[hb->first + 2*i];
+			for (int i=nb+hb->n-1;i<nb+hb->K-1;i++)
+				s[i] = 0.0f;
+			if (hb->H)
+				for (int i=0;i<nb;i++)
+					output[outPos+i] = center * x[2*i + hb->pos] + filter_folded_f(hb->fold_f, s+i, hb->H, hb->n);
+			else
+				for (int i=0;i<nb;i++)
+					output[outPos+i] = center * x[2*i + hb->pos] + hb->kernel_f(hb->taps_f, s+i, hb->K);
+			signalPos += 2*nb;
+			outPos += nb;
+		}
+	}
+
+	// report state values
+	pstate->phase = phase;
+	*nbRead = signalPos;
+	*nbWritten = outPos;
+}
+
+void polyfiltHB_multi_f(struct PSFilter* pfilt, struct PSState* pstate,
+		const float* signal, int signalLen, int* nbRead, float* output,
+		int outputLen, int* nbWritten, const int channels) {
+	const struct PHalfBand* hb = pfilt->halfband;
+	const int K = pfilt->K;
+	const int lead = pfilt->lead;
+	const float center = (float) hb->center;
+
+	int outPos = 0;
+	int phase = pstate->phase;
+	int signalPos = halfband_skip(pfilt,pstate,signalLen,&phase);
+
+	if (pfilt->L==2) {
+		while (signalPos+K<=signalLen && outPos<outputLen)
+		{
+			float* o = output + (size_t)outPos*channels;
+			if (phase==hb->phase) {
+				const float* x = signal + (size_t)(signalPos + hb->pos)*channels;
+				for (int c=0;c<channels;c++)
+					o[c] = center * x[c];
+			} else if (hb->H) {
+				filter_folded_multi_f(hb->fold_f, signal + (size_t)(signalPos + hb->first)*channels, hb->half, hb->n, channels, channels, o);
+			} else {
+				filter_multi_f(pfilt->filters_f + phase*K + lead, signal + (size_t)(signalPos + lead)*channels, K - lead, channels, o);
+			}
+			outPos++;
+			phase++;
+			if (phase==2) {
+				signalPos++;
+				phase=0;
+			}
+		}
+	} else if (hb->H) {
+		// the folded kernel reads every other frame in place, no gathering needed
+		while (signalPos+K<=signalLen && outPos<outputLen)
+		{
+			const float* x = signal + (size_t)signalPos*channels;
+			float* o = output + (size_t)outPos*channels;
+			filter_folded_multi_f(hb->fold_f, x + (size_t)hb->first*channels, hb->half, hb->n, channels, 2*channels, o);
+			const float* xc = x + (size_t)hb->pos*channels;
+			for (int c=0;c<channels;c++)
+				o[c] += center * xc[c];
+			signalPos += 2;
+			outPos++;
+		}
+	} else {
+		float* s = halfband_work(pstate,hb,(size_t)channels*sizeof(float));
+		while (signalPos+K<=signalLen && outPos<outputLen)
+		{
+			const int nb = halfband_block(signalPos,signalLen,K,outputLen-outPos);
+			const float* x = signal + (size_t)signalPos*channels;
+			for (int i=0;i<nb+hb->n-1;i++)
+				memcpy(s + (size_t)i*channels, x + (size_t)(hb->first + 2*i)*channels, channels*sizeof(float));
+			for (int i=0;i<nb;i++) {
+				// no padding: each zero coefficient would cost a pass over all channels
+				float* o = output + (size_t)(outPos+i)*channels;
+				filter_multi_f(hb->taps_f, s + (size_t)i*channels, hb->n, channels, o);
+				const float* xc = x + (size_t)(2*i + hb->pos)*channels;
+				for (int c=0;c<channels;c++)
+					o[c] += center * xc[c];
+			}
+			signalPos += 2*nb;
+			outPos += nb;
+		}
+	}
+
+	// report state values
+	pstate->phase = phase;
+	*nbRead = signalPos;
+	*nbWritten = outPos;
+}
+
+void polyfiltSym(struct PSFilter* pfilt, struct PSState* pstate,
+		const double* SMARC_RESTRICT signal, const int signalLen, int* SMARC_RESTRICT nbConsume,
+		double* SMARC_RESTRICT output, const int outputLen, int* SMARC_RESTRICT nbWritten) {
+	const struct PFolded* fold = pfilt->folded;
+	const int M = pfilt->M;
+	const int K = pfilt->K;
+	// the taps start after the zeros padding the sub-filter
+	const double* in = signal + pfilt->lead;
+
+	int signalPos = 0;
+	int outPos = 0;
+
+	// skip first sample for delays
+	while (pstate->skip>0 && ((signalPos+M)<signalLen)) {
+		pstate->skip--;
+		signalPos += M;
+	}
+
+	// process filtering
+	while (((signalPos+K)<=signalLen) && (outPos<outputLen))
+	{
+		output[outPos++] = filter_folded(fold->taps,in+signalPos,fold->H,fold->n);
+
+		// consume samples
+		signalPos += M;
+	}
+
+	// report state values
+	*nbWritten = outPos;
+	*nbConsume = signalPos;
+}
+
+void polyfiltSym_f(struct PSFilter* pfilt, struct PSState* pstate,
+		const float* SMARC_RESTRICT signal, const int signalLen, int* SMARC_RESTRICT nbConsume,
+		float* SMARC_RESTRICT output, const int outputLen, int* SMARC_RESTRICT nbWritten) {
+	const struct PFolded* fold = pfilt->folded;
+	const int M = pfilt->M;
+	const int K = pfilt->K;
+	const float* in = signal + pfilt->lead;
+
+	int signalPos = 0;
+	int outPos = 0;
+
+	// skip first sample for delays
+	while (pstate->skip>0 && ((signalPos+M)<signalLen)) {
+		pstate->skip--;
+		signalPos += M;
+	}
+
+	// process filtering
+	while (((signalPos+K)<=signalLen) && (outPos<outputLen))
+	{
+		output[outPos++] = filter_folded_f(fold->taps_f,in+signalPos,fold->H,fold->n);
+
+		// consume samples
+		signalPos += M;
+	}
+
+	// report state values
+	*nbWritten = outPos;
+	*nbConsume = signalPos;
+}
+
+void polyfiltSym_multi_f(struct PSFilter* pfilt, struct PSState* pstate,
+		const float* SMARC_RESTRICT signal, const int signalLen, int* SMARC_RESTRICT nbConsume,
+		float* SMARC_RESTRICT output, const int outputLen, int* SMARC_RESTRICT nbWritten, const int channels) {
+	const struct PFolded* fold = pfilt->folded;
+	const int M = pfilt->M;
+	const int K = pfilt->K;
+	const float* in = signal + (size_t)pfilt->lead*channels;
+
+	int signalPos = 0;
+	int outPos = 0;
+
+	// skip first sample for delays
+	while (pstate->skip>0 && ((signalPos+M)<signalLen)) {
+		pstate->skip--;
+		signalPos += M;
+	}
+
+	// process filtering, all channels of a frame at once
+	while (((signalPos+K)<=signalLen) && (outPos<outputLen))
+	{
+		// the zero coefficients padding the folded taps are skipped, as the lead zeros of polyfiltLM_multi_f
+		filter_folded_multi_f(fold->taps_f,in + (size_t)signalPos*channels,fold->half,fold->n,channels,channels,
+				output + (size_t)outPos*channels);
+		outPos++;
+
+		// consume samples
+		signalPos += M;
+	}
+
+	// report state values
+	*nbWritten = outPos;
+	*nbConsume = signalPos;
+}
+
+void polyfiltM_fft(struct PSFilter* pfilt, struct PSState* pstate,
+		const void* signal, const int signalLen, int* nbConsume,
+		void* output, const int outputLen, int* nbWritten, const int sample_size, const int channels) {
+	const struct PFFTFilter* fft = pfilt->fft;
+	const int M = pfilt->M;
+	const int K = pfilt->K;
+	const size_t frame_size = (size_t)sample_size*channels;
+	const char* in = (const char*) signal;
+	char* out = (char*) output;
+
+	int signalPos = 0;
+	int outPos = 0;
+
+	// skip first sample for delays
+	while (pstate->skip>0 && ((signalPos+M)<signalLen)) {
+		pstate->skip--;
+		signalPos += M;
+	}
+
+	while (outPos<outputLen)
+	{
+		if (pstate->fft_pending>0) {
+			// write outputs of the last block
+			int n = outputLen - outPos;
+			if (n>pstate->fft_pending)
+				n = pstate->fft_pending;
+			const double* src = pstate->fft_out + (size_t)pstate->fft_next*channels;
+			const size_t nbSamples = (size_t)n*channels;
+			if (sample_size==sizeof(float)) {
+				float* dst = (float*) (out + outPos*frame_size);
+				for (size_t i=0;i<nbSamples;i++)
+					dst[i] = (float) src[i];
+			} else {
+				memcpy(out + outPos*frame_size,src,nbSamples*sizeof(double));
+			}
+			pstate->fft_next += n;
+			pstate->fft_pending -= n;
+			outPos += n;
+		} else if (signalPos+fft->N*M<=signalLen) {
+			// filter a block
+			if (pstate->fft_work==NULL) {
+				pstate->fft_work = malloc(fftfilter_work_size(fft)*sizeof(double));
+				pstate->fft_out = malloc((size_t)fft->B*channels*sizeof(double));
+			}
+			fftfilter_block(fft,pstate->fft_work,in + signalPos*frame_size,sample_size,channels,pstate->fft_out);
+			pstate->fft_next = 0;
+			pstate->fft_pending = fft->B;
+			signalPos += fft->B*M;
+		} else if (pstate->partial && signalPos+K<=signalLen) {
+			// filter the end of the signal in direct form
+			const struct PFolded* fold = pfilt->folded;
+			if (fold && sample_size==sizeof(double))
+				((double*) out)[outPos] = filter_folded(fold->taps,(const double*) in + signalPos + pfilt->lead,fold->H,fold->n);
+			else if (fold && channels==1)
+				((float*) out)[outPos] = filter_folded_f(fold->taps_f,(const float*) in + signalPos + pfilt->lead,fold->H,fold->n);
+			else if (fold)
+				filter_folded_multi_f(fold->taps_f,(const float*) in + (size_t)(signalPos + pfilt->lead)*channels,fold->half,fold->n,channels,channels,
+						(float*) out + (size_t)outPos*channels);
+			else if (sample_size==sizeof(double))
+				((double*) out)[outPos] = pfilt->kernel(pfilt->filters,(const double*) in + signalPos,K);
+			else if (channels==1)
+				((float*) out)[outPos] = pfilt->kernel_f(pfilt->filters_f,(const float*) in + signalPos,K);
+			else
+				filter_multi_f(pfilt->filters_f + pfilt->lead,(const float*) in + (size_t)(signalPos + pfilt->lead)*channels,K - pfilt->lead,channels,
+						(float*) out + (size_t)outPos*channels);
+			outPos++;
+			signalPos += M;
+		} else {
+			break;
+		}
+	}
+
+	// report state values
+	*nbWritten = outPos;
+	*nbConsume = signalPos;
+}
@@ -76,4 +76,78 @@ void polyfiltL(struct PSFilter* pfilt, struct PSState* pstate,
 		const double* SMARC_RESTRICT signal, const int signalLen, int* SMARC_RESTRICT nbConsume,
 		double* SMARC_RESTRICT output, const int outputLen, int* SMARC_RESTRICT nbWritten);
 
+/**
+ * Same as polyfiltLM, for float signals (uses the float coefficients of pfilt)
+ */
+void polyfiltLM_f(struct PSFilter* pfilt, struct PSState* pstate,
+		const float* SMARC_RESTRICT signal, const int signalLen, int* nbConsume,
+		float* SMARC_RESTRICT output, const int outputLen, int* nbWritten);
+
+/**
+ * Same as polyfiltLM_f, for interleaved frames of several channels:
+ * signalLen and outputLen are counted in frames, sample i of channel c is at [i*channels + c]
+ */
+void polyfiltLM_multi_f(struct PSFilter* pfilt, struct PSState* pstate,
+		const float* SMARC_RESTRICT signal, const int signalLen, int* nbConsume,
+		float* SMARC_RESTRICT output, const int outputLen, int* nbWritten, const int channels);
+
+/**
+ * Same as polyfiltLM, for a half-band filter (pfilt->halfband must not be NULL).
+ * Interpolation outputs the center coefficient phase with a single multiply,
+ * decimation gathers the samples meeting the other non zero coefficients
+ * (every other sample) so that they are filtered contiguously. These side
+ * taps are folded when pfilt->halfband->H is not 0, as in polyfiltSym.
+ */
+void polyfiltHB(struct PSFilter* pfilt, struct PSState* pstate,
+		const double* SMARC_RESTRICT signal, const int signalLen, int* nbConsume,
+		double* SMARC_RESTRICT output, const int outputLen, int* nbWritten);
+
+/**
+ * Same as polyfiltHB, for float signals (uses the float coefficients of pfilt)
+ */
+void polyfiltHB_f(struct PSFilter* pfilt, struct PSState* pstate,
+		const float* SMARC_RESTRICT signal, const int signalLen, int* nbConsume,
+		float* SMARC_RESTRICT output, const int outputLen, int* nbWritten);
+
+/**
+ * Same as polyfiltHB_f, for interleaved frames of several channels, as polyfiltLM_multi_f
+ */
+void polyfiltHB_multi_f(struct PSFilter* pfilt, struct PSState* pstate,
+		const float* SMARC_RESTRICT signal, const int signalLen, int* nbConsume,
+		float* SMARC_RESTRICT output, const int outputLen, int* nbWritten, const int channels);
+
+/**
+ * Same as polyfiltM, for a folded symmetric filter (pfilt->folded must not be NULL):
+ * each pair of samples meeting equal coefficients is added before the multiply,
+ * halving the multiplications.
+ */
+void polyfiltSym(struct PSFilter* pfilt, struct PSState* pstate,
+		const double* SMARC_RESTRICT signal, const int signalLen, int* SMARC_RESTRICT nbConsume,
+		double* SMARC_RESTRICT output, const int outputLen, int* SMARC_RESTRICT nbWritten);
+
+/**
+ * Same as polyfiltSym, for float signals (uses the float coefficients of pfilt)
+ */
+void polyfiltSym_f(struct PSFilter* pfilt, struct PSState* pstate,
+		const float* SMARC_RESTRICT signal, const int signalLen, int* SMARC_RESTRICT nbConsume,
+		float* SMARC_RESTRICT output, const int outputLen, int* SMARC_RESTRICT nbWritten);
+
+/**
+ * Same as polyfiltSym_f, for interleaved frames of several channels, as polyfiltLM_multi_f
+ */
+void polyfiltSym_multi_f(struct PSFilter* pfilt, struct PSState* pstate,
+		const float* SMARC_RESTRICT signal, const int signalLen, int* SMARC_RESTRICT nbConsume,
+		float* SMARC_RESTRICT output, const int outputLen, int* SMARC_RESTRICT nbWritten, const int channels);
+
+/**
+ * Filter interleaved frames with the FFT implementation of a decimation filter
+ * (pfilt->fft must not be NULL), for samples of sample_size bytes (float or double).
+ * Input is consumed by blocks of pfilt->fft->N * M frames, whose outputs are
+ * kept in pstate until output has room for them. Input that does not fill a
+ * block is left unread, or filtered in direct form if pstate->partial is set.
+ */
+void polyfiltM_fft(struct PSFilter* pfilt, struct PSState* pstate,
+		const void* signal, const int signalLen, int* nbConsume,
+		void* output, const int outputLen, int* nbWritten, const int sample_size, const int channels);
+
 #endif /* POLYFILTLM_H_ */
@@ -43,6 +43,7 @@ struct PFilter
 	double rs;
 	int nb_stages;
 	struct PSFilter** filter;
+	int fft_mode;
 };
 
 int smarc_get_fs_in(struct PFilter* pfilt)
@@ -55,6 +56,11 @@ int smarc_get_fs_out(struct PFilter* pfilt)
 	return pfilt->fsout;
 }
 
+void smarc_set_fft_mode(struct PFilter* pfilt, int mode)
+{
+	pfilt->fft_mode = mode;
+}
+
 int smarc_get_output_buffer_size(struct PFilter* pfilt,int inSize)
 {
 	int outSize = 1 + (int) ceil((double)inSize * (double) pfilt->fsout / (double) pfilt->fsin);
@@ -63,12 +69,20 @@ int smarc_get_output_buffer_size(struct PFilter* pfilt,int inSize)
 	{
 		stage_fsout *= (double)pfilt->filter[i]->L / (double)pfilt->filter[i]->M;
 		outSize += ceil( pfilt->fsout * pfilt->filter[i]->filter_delay / stage_fsout);
+		// an FFT stage releases its outputs by blocks
+		if (pfilt->filter[i]->fft)
+			outSize += ceil( pfilt->fsout * pfilt->filter[i]->fft->B / stage_fsout);
 	}
 	return outSize;
 }
 
 
 struct PFilter* smarc_init_pfilter(int fsin, const int fsout, double bandwidth, double rp, double rs, double tol, const char* userratios, int searchfastconversion)
+{
+	return smarc_init_pfilter_design(fsin,fsout,bandwidth,rp,rs,tol,userratios,searchfastconversion,SMARC_DESIGN_REMEZ);
+}
+
+struct PFilter* smarc_init_pfilter_design(int fsin, const int fsout, double bandwidth, double rp, double rs, double tol, const char* userratios, int searchfastconversion, int design)
 {
     if (fsout==fsin)
     {
@@ -103,6 +117,7 @@ struct PFilter* smarc_init_pfilter(int fsin, const int fsout, double bandwidth,
 	pfilt->fsout = fsout;
 	pfilt->rp = rp;
 	pfilt->rs = rs;
+	pfilt->fft_mode = SMARC_FFT_MEASURED;
 
 	pfilt->nb_stages = pdef->nb_stages;
 	pfilt->filter = malloc(pfilt->nb_stages*sizeof(struct PSFilter*));
@@ -124,7 +139,7 @@ struct PFilter* smarc_init_pfilter(int fsin, const int fsout, double bandwidth,
 			fstop = ((stage_fsin * pdef->L[i]) / pdef->M[i]) - (pfilt->fstop);
 		}
 		pfilt->filter[i] = init_psfilter(pdef->L[i],pdef->M[i],
-				fpass / fmax,fstop / fmax,rp,rs,pdef->nb_stages);
+				fpass / fmax,fstop / fmax,rp,rs,pdef->nb_stages,design);
 		if (pfilt->filter[i]==NULL)
 			return NULL;
 		stage_fsin = (stage_fsin * pdef->L[i]) / pdef->M[i];
@@ -161,39 +176,287 @@ void smarc_print_pfilter(struct PFilter* pfilt)
 		printf("  %i / %i : filter length = %i, delay = %i\n",pfilt->filter[s]->L,pfilt->filter[s]->M,pfilt->filter[s]->flen,pfilt->filter[s]->filter_delay);
 }
 
+#define PFILTER_MAGIC 0x31464650 // "PFF1"
+// stages of the longest predefined plan: files with more are rejected
+#define MAX_SAVED_STAGES 6
+
+int smarc_save_pfilter(struct PFilter* pfilt, const char* path)
+{
+	if (pfilt->nb_stages>MAX_SAVED_STAGES)
+		return -1;
+	FILE* f = fopen(path,"wb");
+	if (f==NULL)
+		return -1;
+	const int iheader[4] = { PFILTER_MAGIC, pfilt->fsin, pfilt->fsout, pfilt->nb_stages };
+	const double dheader[4] = { pfilt->fpass, pfilt->fstop, pfilt->rp, pfilt->rs };
+	int res = 0;
+	if (fwrite(iheader,sizeof(int),4,f)!=4 || fwrite(dheader,sizeof(double),4,f)!=4)
+		res = -1;
+	for (int i=0;i<pfilt->nb_stages && res==0;i++)
+		res = save_psfilter(pfilt->filter[i],f);
+	if (fclose(f)!=0)
+		res = -1;
+	return res;
+}
+
+struct PFilter* smarc_load_pfilter(const char* path)
+{
+	FILE* f = fopen(path,"rb");
+	if (f==NULL)
+		return NULL;
+	int iheader[4];
+	double dheader[4];
+	if (fread(iheader,sizeof(int),4,f)!=4 || iheader[0]!=PFILTER_MAGIC
+			|| iheader[1]<=0 || iheader[2]<=0 || iheader[3]<=0 || iheader[3]>MAX_SAVED_STAGES
+			|| fread(dheader,sizeof(double),4,f)!=4)
+	{
+		fclose(f);
+		return NULL;
+	}
+
+	struct PFilter* pfilt = malloc(sizeof(struct PFilter));
+	if (pfilt==NULL)
+	{
+		fclose(f);
+		return NULL;
+	}
+	pfilt->fsin = iheader[1];
+	pfilt->fsout = iheader[2];
+	pfilt->nb_stages = iheader[3];
+	pfilt->fpass = dheader[0];
+	pfilt->fstop = dheader[1];
+	pfilt->rp = dheader[2];
+	pfilt->rs = dheader[3];
+	pfilt->fft_mode = SMARC_FFT_MEASURED;
+	pfilt->filter = malloc(pfilt->nb_stages*sizeof(struct PSFilter*));
+	if (pfilt->filter==NULL)
+	{
+		free(pfilt);
+		fclose(f);
+		return NULL;
+	}
+	for (int i=0;i<pfilt->nb_stages;i++)
+	{
+		pfilt->filter[i] = load_psfilter(f);
+		if (pfilt->filter[i]==NULL)
+		{
+			pfilt->nb_stages = i;
+			smarc_destroy_pfilter(pfilt);
+			fclose(f);
+			return NULL;
+		}
+	}
+	fclose(f);
+	return pfilt;
+}
+
+/**
+ * Filters one stage; signal and output point to frames of the PState sample type
+ * holding one sample per channel
+ */
+typedef void (*PStageFilterFunc)(struct PSFilter* pfilt, struct PSState* pstate,
+		const void* signal, int signalLen, int* nbRead,
+		void* output, int outputLen, int* nbWritten, int channels);
+
+static void stage_filter(struct PSFilter* pfilt, struct PSState* pstate,
+		const void* signal, int signalLen, int* nbRead,
+		void* output, int outputLen, int* nbWritten, int channels)
+{
+	// single channel: channels is always 1
+	(void) channels;
+	if (pstate->use_fft)
+		polyfiltM_fft(pfilt,pstate,signal,signalLen,nbRead,output,outputLen,nbWritten,sizeof(double),1);
+	else if (pfilt->halfband)
+		polyfiltHB(pfilt,pstate,(const double*) signal,signalLen,nbRead,(double*) output,outputLen,nbWritten);
+	else if (pfilt->folded)
+		polyfiltSym(pfilt,pstate,(const double*) signal,signalLen,nbRead,(double*) output,outputLen,nbWritten);
+	else
+		polyfiltLM(pfilt,pstate,(const double*) signal,signalLen,nbRead,(double*) output,outputLen,nbWritten);
+}
+
+static void stage_filter_f(struct PSFilter* pfilt, struct PSState* pstate,
+		const void* signal, int signalLen, int* nbRead,
+		void* output, int outputLen, int* nbWritten, int channels)
+{
+	// single channel: channels is always 1
+	(void) channels;
+	if (pstate->use_fft)
+		polyfiltM_fft(pfilt,pstate,signal,signalLen,nbRead,output,outputLen,nbWritten,sizeof(float),1);
+	else if (pfilt->halfband)
+		polyfiltHB_f(pfilt,pstate,(const float*) signal,signalLen,nbRead,(float*) output,outputLen,nbWritten);
+	else if (pfilt->folded)
+		polyfiltSym_f(pfilt,pstate,(const float*) signal,signalLen,nbRead,(float*) output,outputLen,nbWritten);
+	else
+		polyfiltLM_f(pfilt,pstate,(const float*) signal,signalLen,nbRead,(float*) output,outputLen,nbWritten);
+}
+
+static void stage_filter_multi_f(struct PSFilter* pfilt, struct PSState* pstate,
+		const void* signal, int signalLen, int* nbRead,
+		void* output, int outputLen, int* nbWritten, int channels)
+{
+	if (pstate->use_fft)
+		polyfiltM_fft(pfilt,pstate,signal,signalLen,nbRead,output,outputLen,nbWritten,sizeof(float),channels);
+	else if (pfilt->halfband)
+		polyfiltHB_multi_f(pfilt,pstate,(const float*) signal,signalLen,nbRead,(float*) output,outputLen,nbWritten,channels);
+	else if (pfilt->folded)
+		polyfiltSym_multi_f(pfilt,pstate,(const float*) signal,signalLen,nbRead,(float*) output,outputLen,nbWritten,channels);
+	else
+		polyfiltLM_multi_f(pfilt,pstate,(const float*) signal,signalLen,nbRead,(float*) output,outputLen,nbWritten,channels);
+}
+
+/**
+ * Ring buffer of frames between two stages. The first `guard` frames are
+ * mirrored right after the end of the buffer, so that the next stage always
+ * sees a window of up to guard+1 frames as contiguous memory and data never
+ * has to be moved back to the start of the buffer. The input of an FFT stage
+ * has a guard of a whole FFT block instead, so that blocks are contiguous too.
+ */
 struct PStageBuffer
 {
-	double* data;
-	int size;
-	int pos;
+	char* data; // size + guard frames
+	int size; // capacity in frames
+	int guard; // length of the next stage filter (or FFT block) minus one
+	int read; // index of the first frame held
+	int count; // number of frames held
 };
 
 struct PState
 {
 	int nb_stages;
+	int sample_size; // size of one sample of one channel in bytes
+	int channels; // number of interleaved channels
+	int frame_size; // size of one frame (one sample of every channel) in bytes
+	PStageFilterFunc filter_stage;
 	struct PSState** state;
 	struct PStageBuffer** buffer;
 	// flush vars
-	double* flush_buf;
+	int flushing;
+	char* flush_buf;
 	int flush_size;
 	int flush_pos;
 	int flush_stage;
 };
 
-struct PState* smarc_init_pstate(struct PFilter* pfilt)
+// FFT implementation of stage i if pstate uses it, NULL otherwise
+static const struct PFFTFilter* stage_fft(const struct PState* pstate, const struct PFilter* pfilt, int i)
+{
+	return pstate->state[i]->use_fft ? pfilt->filter[i]->fft : NULL;
+}
+
+// address of frame i in buffer data
+#define FRAME(pstate,data,i) ((data) + (size_t)(i) * (pstate)->frame_size)
+
+// number of frames held that can be read contiguously from buf->read
+static int ring_readable(const struct PStageBuffer* buf)
+{
+	const int n = buf->size + buf->guard - buf->read;
+	return n<buf->count ? n : buf->count;
+}
+
+// index of the first free frame
+static int ring_write_pos(const struct PStageBuffer* buf)
+{
+	const int w = buf->read + buf->count;
+	return w<buf->size ? w : w - buf->size;
+}
+
+// number of free frames that can be written contiguously from ring_write_pos
+static int ring_writable(const struct PStageBuffer* buf)
+{
+	const int w = ring_write_pos(buf);
+	const int n = buf->size - w;
+	const int free_frames = buf->size - buf->count;
+	return n<free_frames ? n : free_frames;
+}
+
+// address of the frame at position p from the first frame held
+static char* ring_frame(struct PState* pstate, const struct PStageBuffer* buf, int p)
+{
+	int i = (buf->read + p) % buf->size;
+	if (i<0)
+		i += buf->size;
+	return FRAME(pstate,buf->data,i);
+}
+
+// add n frames that have been written at ring_write_pos
+static void ring_commit(struct PState* pstate, struct PStageBuffer* buf, int n)
+{
+	const int w = ring_write_pos(buf);
+	if (w<buf->guard) {
+		const int m = n<buf->guard-w ? n : buf->guard-w;
+		memcpy(FRAME(pstate,buf->data,buf->size+w),FRAME(pstate,buf->data,w),(size_t)m*pstate->frame_size);
+	}
+	buf->count += n;
+}
+
+// drop the first n frames held
+static void ring_consume(struct PStageBuffer* buf, int n)
+{
+	buf->read += n;
+	if (buf->read>=buf->size)
+		buf->read -= buf->size;
+	buf->count -= n;
+}
+
+// copy n frames into the buffer, which must have room for them
+static void ring_push(struct PState* pstate, struct PStageBuffer* buf, const char* frames, int n)
+{
+	while (n>0) {
+		int m = ring_writable(buf);
+		if (m>n)
+			m = n;
+		memcpy(FRAME(pstate,buf->data,ring_write_pos(buf)),frames,(size_t)m*pstate->frame_size);
+		ring_commit(pstate,buf,m);
+		frames = FRAME(pstate,frames,m);
+		n -= m;
+	}
+}
+
+// move the first n frames held out of the buffer
+static void ring_pop(struct PState* pstate, struct PStageBuffer* buf, char* frames, int n)
+{
+	while (n>0) {
+		int m = buf->size - buf->read;
+		if (m>n)
+			m = n;
+		memcpy(frames,FRAME(pstate,buf->data,buf->read),(size_t)m*pstate->frame_size);
+		ring_consume(buf,m);
+		frames = FRAME(pstate,frames,m);
+		n -= m;
+	}
+}
+
+static struct PState* init_pstate(struct PFilter* pfilt, int sample_size, int channels, PStageFilterFunc filter_stage)
 {
 	struct PState* pstate = malloc(sizeof(struct PState));
 	pstate->nb_stages = pfilt->nb_stages;
+	pstate->sample_size = sample_size;
+	pstate->channels = channels;
+	pstate->frame_size = sample_size * channels;
+	pstate->filter_stage = filter_stage;
 	pstate->flush_buf = NULL;
 
 	// init states
 	pstate->state = malloc(pstate->nb_stages*sizeof(struct PSState*));
-	for (int i=0;i<pstate->nb_stages;i++)
-		pstate->state[i] = init_psstate(pfilt->filter[i]);
+	for (int i=0;i<pstate->nb_stages;i++) {
+		struct PSFilter* filt = pfilt->filter[i];
+		pstate->state[i] = init_psstate(filt);
+		// interleaved channels skip the zeros padding the filter, half-band
+		// filters the zeros between their coefficients and folded filters
+		// half of their coefficients
+		int taps = channels==1 ? filt->K : filt->K - filt->lead;
+		if (filt->halfband && filt->halfband->H)
+			taps = 1 + (channels==1 ? filt->halfband->H : filt->halfband->half);
+		else if (filt->halfband)
+			taps = 1 + (channels==1 ? filt->halfband->K : filt->halfband->n);
+		else if (filt->folded)
+			taps = channels==1 ? filt->folded->H : filt->folded->half;
+		pstate->state[i]->use_fft = filt->fft && pfilt->fft_mode==SMARC_FFT_MEASURED
+				&& fftfilter_faster(filt->fft,taps,sample_size,channels);
+	}
 
 	// init buffers
 	pstate->buffer = malloc((pstate->nb_stages+1)*sizeof(struct PStageBuffer*));
-	int total_size = 0;
 	int current_buffer_size = 0;
 	for (int i=0;i<pstate->nb_stages+1;i++)
 	{
@@ -209,26 +472,63 @@ struct PState* smarc_init_pstate(struct PFilter* pfilt)
 		if (i<pstate->nb_stages)
 			filter_len = pfilt->filter[i]->K - 1;
 		cbuf->size = current_buffer_size + filter_len;
-		cbuf->pos = 0;
+		cbuf->guard = filter_len;
+		const struct PFFTFilter* fft = i<pstate->nb_stages ? stage_fft(pstate,pfilt,i) : NULL;
+		if (fft) {
+			// room for a block while the previous one is filled
+			const int block = fft->N * pfilt->filter[i]->M;
+			if (cbuf->size<2*block)
+				cbuf->size = 2*block;
+			cbuf->guard = block - 1;
+		}
+		cbuf->read = 0;
+		cbuf->count = 0;
 //		printf("buffer %i has buffer size %i + %i = %i \n",i,current_buffer_size,filter_len,cbuf->size);
-		total_size += cbuf->size;
 	}
 
-	// allocate all buffer contiguously
-	pstate->buffer[0]->data = (double*) malloc(total_size*sizeof(double));
-	for (int i=1;i<pstate->nb_stages+1;i++)
-		pstate->buffer[i]->data = pstate->buffer[i-1]->data + pstate->buffer[i-1]->size;
+	// allocate all buffer contiguously, each one starting aligned as the filters
+	size_t offset = 0;
+	size_t* offsets = malloc((pstate->nb_stages+1)*sizeof(size_t));
+	for (int i=0;i<pstate->nb_stages+1;i++) {
+		offsets[i] = offset;
+		offset += (size_t)(pstate->buffer[i]->size + pstate->buffer[i]->guard)*pstate->frame_size;
+		offset = (offset + SMARC_FILTER_ALIGN - 1) / SMARC_FILTER_ALIGN * SMARC_FILTER_ALIGN;
+	}
+	char* data = (char*) smarc_aligned_malloc(offset);
+	for (int i=0;i<pstate->nb_stages+1;i++)
+		pstate->buffer[i]->data = data + offsets[i];
+	free(offsets);
 
 	// reset pstate before returning it
 	smarc_reset_pstate(pstate,pfilt);
 	return pstate;
 }
 
+struct PState* smarc_init_pstate(struct PFilter* pfilt)
+{
+	return init_pstate(pfilt,sizeof(double),1,stage_filter);
+}
+
+struct PState* smarc_init_pstate_f(struct PFilter* pfilt)
+{
+	return init_pstate(pfilt,sizeof(float),1,stage_filter_f);
+}
+
+struct PState* smarc_init_pstate_multi_f(struct PFilter* pfilt, int channels)
+{
+	if (channels<1)
+		return NULL;
+	if (channels==1)
+		return smarc_init_pstate_f(pfilt);
+	return init_pstate(pfilt,sizeof(float),channels,stage_filter_multi_f);
+}
+
 void smarc_destroy_pstate(struct PState* pstate)
 {
 	for (int i=0;i<pstate->nb_stages;i++)
 		destroy_psstate(pstate->state[i]);
-	free(pstate->buffer[0]->data);
+	free(pstate->state);
+	smarc_aligned_free(pstate->buffer[0]->data);
 	for (int i=0;i<pstate->nb_stages+1;i++)
 		free(pstate->buffer[i]);
 	if (pstate->flush_buf)
@@ -241,26 +541,35 @@ void smarc_reset_pstate(struct PState* pstate, struct PFilter* pfilt)
 {
 	for (int i=0;i<pstate->nb_stages;i++)
 		reset_psstate(pstate->state[i],pfilt->filter[i]);
+	for (int i=0;i<pstate->nb_stages+1;i++) {
+		struct PStageBuffer* buf = pstate->buffer[i];
+		buf->read = 0;
+		buf->count = 0;
+	}
+	// stage inputs start with K-1 zeros
 	for (int i=0;i<pstate->nb_stages;i++) {
 		struct PStageBuffer* buf = pstate->buffer[i];
-		buf->pos = pfilt->filter[i]->K - 1;
-		for (int k=0;k<buf->pos;k++)
-			buf->data[k] = 0;
+		const int n = pfilt->filter[i]->K - 1;
+		memset(buf->data,0,(size_t)n*pstate->frame_size);
+		ring_commit(pstate,buf,n);
 	}
-	pstate->buffer[pstate->nb_stages]->pos = 0;
 	if (pstate->flush_buf) {
 		free(pstate->flush_buf);
 		pstate->flush_buf = NULL;
 	}
+	pstate->flushing = 0;
 	pstate->flush_stage = 0;
 	pstate->flush_pos = 0;
 	pstate->flush_size = 0;
 }
 
-int smarc_resample(struct PFilter* pfilt, struct PState* pstate,
-		const double* signal,
+/**
+ * smarc_resample for any sample type: signal and output hold frames of pstate->frame_size bytes
+ */
+static int resample_frames(struct PFilter* pfilt, struct PState* pstate,
+		const char* signal,
 		int signalLength,
-		double* output,
+		char* output,
 		int outputLength)
 {
 	int nbRead = 0;
@@ -272,15 +581,14 @@ int smarc_resample(struct PFilter* pfilt, struct PState* pstate,
 		// fill first buffer
 		{
 			struct PStageBuffer* fbuf = pstate->buffer[0];
-			int toRead = fbuf->size - fbuf->pos;
+			int toRead = fbuf->size - fbuf->count;
 			if (toRead>signalLength-nbRead)
 				toRead = signalLength - nbRead;
 			else
 				inputRemains = 1;
-//			printf("Push %i sample in first buffer %i/%i\n",toRead,fbuf->pos,fbuf->size);
+//			printf("Push %i sample in first buffer %i/%i\n",toRead,fbuf->count,fbuf->size);
 			if (toRead>0) {
-				memcpy(fbuf->data + fbuf->pos, signal + nbRead, toRead*sizeof(double));
-				fbuf->pos += toRead;
+				ring_push(pstate,fbuf,FRAME(pstate,signal,nbRead),toRead);
 				nbRead += toRead;
 			}
 		}
@@ -291,48 +599,62 @@ int smarc_resample(struct PFilter* pfilt, struct PState* pstate,
 			struct PSState* state = pstate->state[i];
 			struct PStageBuffer* inbuf = pstate->buffer[i];
 			struct PStageBuffer* outbuf = pstate->buffer[i+1];
-			int nbStageRead;
-			int nbStageWritten;
-			polyfiltLM(filt,state,inbuf->data,inbuf->pos,&nbStageRead,outbuf->data + outbuf->pos,outbuf->size - outbuf->pos,&nbStageWritten);
-
-//			printf("stage %i: read %i [%i/%i] write %i [%i/%i] K=%i\n",i,nbStageRead,inbuf->pos,inbuf->size,nbStageWritten,outbuf->pos,outbuf->size,filt->K);
-
-			// keep non processed input
-			if (nbStageRead<inbuf->pos) {
-				memmove(inbuf->data, inbuf->data + nbStageRead, (inbuf->pos - nbStageRead)*sizeof(double));
+			// FFT stages wait for whole blocks until they are flushed
+			state->partial = pstate->flushing && i<=pstate->flush_stage;
+			// the readable window may end at the mirrored guard and the
+			// writable one at the end of the output buffer: filter until
+			// no more progress is made
+			int nbStageRead = 1;
+			int nbStageWritten = 1;
+			while (nbStageRead>0 || nbStageWritten>0) {
+				nbStageRead = 0;
+				nbStageWritten = 0;
+				const int inLen = ring_readable(inbuf);
+				const int outLen = ring_writable(outbuf);
+				if (inLen==0 || outLen==0)
+					break;
+				pstate->filter_stage(filt,state,FRAME(pstate,inbuf->data,inbuf->read),inLen,&nbStageRead,
+						FRAME(pstate,outbuf->data,ring_write_pos(outbuf)),outLen,&nbStageWritten,pstate->channels);
+
+//				printf("stage %i: read %i [%i/%i] write %i [%i/%i] K=%i\n",i,nbStageRead,inbuf->count,inbuf->size,nbStageWritten,outbuf->count,outbuf->size,filt->K);
+
+				// keep non processed input
+				ring_consume(inbuf,nbStageRead);
+				// update output
+				ring_commit(pstate,outbuf,nbStageWritten);
 			}
-			inbuf->pos -= nbStageRead;
-			if (inbuf->pos>filt->K-1)
+			const struct PFFTFilter* fft = stage_fft(pstate,pfilt,i);
+			const int needed = (fft && !state->partial) ? fft->N * filt->M : filt->K;
+			if (inbuf->count>=needed || state->fft_pending>0)
 				inputRemains = 1;
-
-			// update output pos
-			outbuf->pos += nbStageWritten;
 		}
 		// report last buffer to output
 		{
 			struct PStageBuffer* lbuf = pstate->buffer[pstate->nb_stages];
-			int toWrite = lbuf->pos;
+			int toWrite = lbuf->count;
 			if (nbWritten + toWrite >= outputLength) {
 				printf("WARNING: cannot write all output samples, please provide larger output buffer !");
 				toWrite = outputLength - nbWritten;
 			}
-//			printf("write %i samples from last buf %i/%i into output buffer %i/%i\n",toWrite,lbuf->pos,lbuf->size,*nbWritten,outputLength);
+//			printf("write %i samples from last buf %i/%i into output buffer %i/%i\n",toWrite,lbuf->count,lbuf->size,*nbWritten,outputLength);
 			if (toWrite>0)
-				memcpy(output + nbWritten,lbuf->data,toWrite*sizeof(double));
-			if (toWrite<lbuf->pos)
-				memmove(lbuf->data,lbuf->data+toWrite,(lbuf->pos-toWrite)*sizeof(double));
+				ring_pop(pstate,lbuf,FRAME(pstate,output,nbWritten),toWrite);
 			nbWritten += toWrite;
-			lbuf->pos -= toWrite;
 		}
 	}
 	return nbWritten;
 }
 
-int smarc_resample_flush(struct PFilter* pfilt, struct PState* pstate,
-		double* output,
+/**
+ * smarc_resample_flush for any sample type: output holds frames of pstate->frame_size bytes
+ */
+static int resample_flush_frames(struct PFilter* pfilt, struct PState* pstate,
+		char* output,
 		int outputLength)
 {
+	const size_t fs = pstate->frame_size;
 	int nbWritten = 0;
+	pstate->flushing = 1;
 	// flush all stages
 	while (pstate->flush_stage<pfilt->nb_stages && nbWritten<outputLength)
 	{
@@ -340,43 +662,44 @@ int smarc_resample_flush(struct PFilter* pfilt, struct PState* pstate,
 		struct PSFilter* filt = pfilt->filter[pstate->flush_stage];
 		struct PStageBuffer* inbuf = pstate->buffer[pstate->flush_stage];
 		if (pstate->flush_buf==NULL) {
-			int toFlush = filt->K - 1 - inbuf->pos + (filt->filter_delay * filt->M) / filt->L;
-			if (toFlush<(inbuf->size-inbuf->pos)) {
+			const int held = inbuf->count;
+			// an FFT stage may still hold input the direct form would have consumed
+			int unread = held;
+			if (stage_fft(pstate,pfilt,pstate->flush_stage) && unread>=filt->K)
+				unread -= filt->M * ((unread - filt->K) / filt->M + 1);
+			int toFlush = filt->K - 1 - unread + (filt->filter_delay * filt->M) / filt->L;
+			if (toFlush<(inbuf->size-held)) {
 //				printf("flushing straight %i samples\n",toFlush);
 				// just write flush samples into buffer
 				for (int k=0;k<toFlush;k++)
-					inbuf->data[inbuf->pos+k] = inbuf->data[inbuf->pos - 2 - k];
-				inbuf->pos += toFlush;
+					ring_push(pstate,inbuf,ring_frame(pstate,inbuf,held - 2 - k),1);
 			} else {
 				// remember samples to flush
-				pstate->flush_buf = (double*) malloc(toFlush*sizeof(double));
+				pstate->flush_buf = (char*) malloc(toFlush*fs);
 				pstate->flush_size = toFlush;
 				for (int k=0;k<toFlush;k++)
-					pstate->flush_buf[k] = inbuf->data[inbuf->pos - 2 - k];
+					memcpy(FRAME(pstate,pstate->flush_buf,k),ring_frame(pstate,inbuf,held - 2 - k),fs);
 				// fill inbuf
-				for (int k=0;k<inbuf->size-inbuf->pos;k++)
-					inbuf->data[inbuf->pos+k] = pstate->flush_buf[k];
-//				printf("flushing %i/%i samples\n", inbuf->size-inbuf->pos, toFlush);
-				pstate->flush_pos = inbuf->size-inbuf->pos;
-				inbuf->pos = inbuf->size;
+//				printf("flushing %i/%i samples\n", inbuf->size-held, toFlush);
+				pstate->flush_pos = inbuf->size-held;
+				ring_push(pstate,inbuf,pstate->flush_buf,pstate->flush_pos);
 			}
 		} else {
 			// continue flushing
-			int toWrite = inbuf->size - inbuf->pos;
+			int toWrite = inbuf->size - inbuf->count;
 			if (toWrite> (pstate->flush_size-pstate->flush_pos))
 				toWrite = pstate->flush_size-pstate->flush_pos;
-			for (int k=0;k<toWrite;k++)
-				inbuf->data[inbuf->pos+k] = pstate->flush_buf[pstate->flush_pos+k];
+			ring_push(pstate,inbuf,FRAME(pstate,pstate->flush_buf,pstate->flush_pos),toWrite);
 //			printf("flushing next %i samples starting at %i/%i\n",toWrite,pstate->flush_pos,pstate->flush_size);
 			pstate->flush_pos += toWrite;
-			inbuf->pos += toWrite;
 		}
 
 		// process filtering
-		nbWritten += smarc_resample(pfilt,pstate,NULL,0,output + nbWritten, outputLength - nbWritten);
+		nbWritten += resample_frames(pfilt,pstate,NULL,0,FRAME(pstate,output,nbWritten), outputLength - nbWritten);
 
 		// check if all have been read
-		if ((inbuf->pos<filt->K) && (pstate->flush_pos==pstate->flush_size)) {
+		if ((inbuf->count<filt->K) && (pstate->flush_pos==pstate->flush_size)
+				&& pstate->state[pstate->flush_stage]->fft_pending==0) {
 			// end flushing this stage
 			if (pstate->flush_buf) {
 				free(pstate->flush_buf);
@@ -387,5 +710,84 @@ int smarc_resample_flush(struct PFilter* pfilt, struct PState* pstate,
 			pstate->flush_stage++;
 		}
 	}
+	// outputs left over when the output was full
+	if (pstate->flush_stage==pfilt->nb_stages && nbWritten<outputLength) {
+		struct PStageBuffer* lbuf = pstate->buffer[pstate->nb_stages];
+		int toWrite = lbuf->count;
+		if (toWrite>outputLength-nbWritten)
+			toWrite = outputLength - nbWritten;
+		ring_pop(pstate,lbuf,FRAME(pstate,output,nbWritten),toWrite);
+		nbWritten += toWrite;
+	}
 	return nbWritten;
 }
+
+static int check_frame_size(struct PState* pstate, int sample_size, int channels)
+{
+	if (pstate->sample_size!=sample_size || pstate->channels!=channels)
+	{
+		printf("ERROR: PState was initialized for another sample type !\n");
+		return 0;
+	}
+	return 1;
+}
+
+int smarc_resample(struct PFilter* pfilt, struct PState* pstate,
+		const double* signal,
+		int signalLength,
+		double* output,
+		int outputLength)
+{
+	if (!check_frame_size(pstate,sizeof(double),1))
+		return 0;
+	return resample_frames(pfilt,pstate,(const char*) signal,signalLength,(char*) output,outputLength);
+}
+
+int smarc_resample_flush(struct PFilter* pfilt, struct PState* pstate,
+		double* output,
+		int outputLength)
+{
+	if (!check_frame_size(pstate,sizeof(double),1))
+		return 0;
+	return resample_flush_frames(pfilt,pstate,(char*) output,outputLength);
+}
+
+int smarc_resample_f(struct PFilter* pfilt, struct PState* pstate,
+		const float* signal,
+		int signalLength,
+		float* output,
+		int outputLength)
+{
+	if (!check_frame_size(pstate,sizeof(float),1))
+		return 0;
+	return resample_frames(pfilt,pstate,(const char*) signal,signalLength,(char*) output,outputLength);
+}
+
+int smarc_resample_flush_f(struct PFilter* pfilt, struct PState* pstate,
+		float* output,
+		int outputLength)
+{
+	if (!check_frame_size(pstate,sizeof(float),1))
+		return 0;
+	return resample_flush_frames(pfilt,pstate,(char*) output,outputLength);
+}
+
+int smarc_resample_multi_f(struct PFilter* pfilt, struct PState* pstate,
+		const float* signal,
+		int signalFrames,
+		float* output,
+		int outputFrames)
+{
+	if (!check_frame_size(pstate,sizeof(float),pstate->channels))
+		return 0;
+	return resample_frames(pfilt,pstate,(const char*) signal,signalFrames,(char*) output,outputFrames);
+}
+
+int smarc_resample_flush_multi_f(struct PFilter* pfilt, struct PState* pstate,
+		float* output,
+		int outputFrames)
+{
+	if (!check_frame_size(pstate,sizeof(float),pstate->channels))
+		return 0;
+	return resample_flush_frames(pfilt,pstate,(char*) output,outputFrames);
+}
@@ -55,6 +55,43 @@ struct PFilter* smarc_init_pfilter(int fsin, const int fsout,
 		double bandwidth, double rp, double rs,
 		double tol, const char* userratios, int searchfastconversion);
 
+/**
+ * Filter design methods of the stages of a PFilter
+ * - SMARC_DESIGN_REMEZ: equiripple (Remez exchange) filters, the shortest filters meeting the
+ *                       specification. Long filters take up to seconds to design.
+ * - SMARC_DESIGN_KAISER: Kaiser windowed sinc filters, designed in microseconds. A window has the
+ *                        same ripple in both bands, so they meet the specification with about 60%
+ *                        more taps and resample slower.
+ */
+enum smarc_design {
+	SMARC_DESIGN_REMEZ = 0,
+	SMARC_DESIGN_KAISER = 1
+};
+
+/**
+ * Same as smarc_init_pfilter, designing the stage filters with the given smarc_design method.
+ */
+struct PFilter* smarc_init_pfilter_design(int fsin, const int fsout,
+		double bandwidth, double rp, double rs,
+		double tol, const char* userratios, int searchfastconversion, int design);
+
+/**
+ * How the states of a PFilter choose between FFT and direct form filtering of long decimation stages
+ * - SMARC_FFT_MEASURED: the FFT where it is faster, by timings measured once per process. Timings
+ *                       vary from run to run, and with them the last bits of the output.
+ * - SMARC_FFT_DIRECT: always the direct form, so that the output does not depend on timings.
+ */
+enum smarc_fft_mode {
+	SMARC_FFT_MEASURED = 0,
+	SMARC_FFT_DIRECT = 1
+};
+
+/**
+ * Set how the states created afterwards for pfilt filter its stages, a smarc_fft_mode value.
+ * Filters are created with SMARC_FFT_MEASURED.
+ */
+void smarc_set_fft_mode(struct PFilter* pfilt, int mode);
+
 /**
  * release PFilter
  */
@@ -81,6 +118,24 @@ int smarc_get_output_buffer_size(struct PFilter* pfilt,int inSize);
  */
 void smarc_print_pfilter(struct PFilter*);
 
+/**
+ * Save PFilter to a binary file so that it can be reloaded without designing it again.
+ * The file format is specific to the machine that wrote it.
+ * - pfilt (IN) : filter to save
+ * - path (IN) : file to write
+ * Returns 0 on success, -1 on failure or if pfilt has more stages than the
+ * longest predefined plan (6), which smarc_load_pfilter rejects.
+ */
+int smarc_save_pfilter(struct PFilter* pfilt, const char* path);
+
+/**
+ * Load a PFilter saved by smarc_save_pfilter. Returned pointer must be freed by calling smarc_destroy_pfilter.
+ * - path (IN) : file to read
+ * Returns NULL if the file does not exist or does not contain a valid PFilter,
+ * including filters that are longer than designs can be.
+ */
+struct PFilter* smarc_load_pfilter(const char* path);
+
 /**
  * PState represent a filter state. A PFilter may be used to filter several channels, each channels having its own PState.
  */
@@ -91,6 +146,20 @@ struct PState;
  */
 struct PState* smarc_init_pstate(struct PFilter*);
 
+/**
+ * Create a PState for a given PFilter, to resample float signals with smarc_resample_f and smarc_resample_flush_f.
+ * The whole conversion runs in single precision. Returned pointer must be freed by destroy_pstate()
+ */
+struct PState* smarc_init_pstate_f(struct PFilter*);
+
+/**
+ * Create a PState to resample several float channels at once with smarc_resample_multi_f and
+ * smarc_resample_flush_multi_f. Signals are interleaved frames: sample i of channel c is at [i*channels + c].
+ * All channels go through the filter phases together, which reuses each coefficient across channels.
+ * Returned pointer must be freed by destroy_pstate(). Returns NULL if channels < 1.
+ */
+struct PState* smarc_init_pstate_multi_f(struct PFilter*, int channels);
+
 /**
  * Free PState
  */
@@ -130,6 +199,113 @@ int smarc_resample_flush(struct PFilter*, struct PState*,
 		double* output,
 		int outputLength);
 
+/**
+ * Same as smarc_resample, for float signals. pstate must have been created by smarc_init_pstate_f.
+ */
+int smarc_resample_f(struct PFilter* pfilter, struct PState* pstate,
+		const float* signal,
+		int signalLength,
+		float* output,
+		int outputLength);
+
+/**
+ * Same as smarc_resample_flush, for float signals. pstate must have been created by smarc_init_pstate_f.
+ */
+int smarc_resample_flush_f(struct PFilter*, struct PState*,
+		float* output,
+		int outputLength);
+
+/**
+ * Same as smarc_resample_f, for interleaved multi-channel signals. pstate must have been created by
+ * smarc_init_pstate_multi_f. Lengths are counted in frames (one sample of every channel), and
+ * smarc_get_output_buffer_size gives the number of output frames to provide.
+ */
+int smarc_resample_multi_f(struct PFilter* pfilter, struct PState* pstate,
+		const float* signal,
+		int signalFrames,
+		float* output,
+		int outputFrames);
+
+/**
+ * Same as smarc_resample_flush_f, for interleaved multi-channel signals. pstate must have been
+ * created by smarc_init_pstate_multi_f. outputFrames is counted in frames.
+ */
+int smarc_resample_flush_multi_f(struct PFilter*, struct PState*,
+		float* output,
+		int outputFrames);
+
+/**
+ * FFilter represent a fractional-ratio resampling filter. Unlike PFilter, input and output
+ * samplerates may be any positive real numbers, e.g. a measured effective samplerate.
+ */
+struct FFilter;
+
+/**
+ * Build a FFilter (Kaiser windowed sinc with interpolated phases). Given pointer must be freed by
+ * calling smarc_destroy_ffilter. Returns NULL if the filter cannot be designed.
+ * - fsin (IN) : frequency samplerate of input signal
+ * - fsout (IN) : desired frequency samplerate for output signal
+ * - bandwidth (IN) : bandwidth to keep, real in 0..1, as for smarc_init_pfilter.
+ * - rs (IN) : Stopband ripple factor, in dB.
+ * The filter length grows with rs / (1 - bandwidth) and with fsin / fsout when downsampling.
+ */
+struct FFilter* smarc_init_ffilter(double fsin, double fsout, double bandwidth, double rs);
+
+/**
+ * release FFilter
+ */
+void smarc_destroy_ffilter(struct FFilter*);
+
+/**
+ * Returns the output buffer size (in frames) needed to resample inSize input frames with a FFilter.
+ */
+int smarc_get_foutput_buffer_size(struct FFilter*, int inSize);
+
+/**
+ * FState represent the state of a fractional resampling of interleaved float channels.
+ */
+struct FState;
+
+/**
+ * Create a FState for a given FFilter and number of interleaved channels (sample i of
+ * channel c at [i*channels + c]). Returned pointer must be freed by smarc_destroy_fstate().
+ */
+struct FState* smarc_init_fstate(struct FFilter*, int channels);
+
+/**
+ * Free FState
+ */
+void smarc_destroy_fstate(struct FState*);
+
+/**
+ * Reset FState so that it can be used to process another signal.
+ */
+void smarc_reset_fstate(struct FState*, struct FFilter*);
+
+/**
+ * Set the input position of output frame 0, in input frames (0 by default, negative
+ * positions are taken as 0). Used to sample the signal on a time grid that is not
+ * aligned with its first sample. Must be called before any input is given.
+ */
+void smarc_set_fstate_start(struct FState*, double start);
+
+/**
+ * Same as smarc_resample_multi_f, with a FFilter. Output frame m is the signal at input
+ * position start + m*fsin/fsout. Lengths are counted in frames.
+ */
+int smarc_fresample_f(struct FFilter*, struct FState*,
+		const float* signal,
+		int signalFrames,
+		float* output,
+		int outputFrames);
+
+/**
+ * Same as smarc_resample_flush_multi_f, with a FFilter. May be called until it returns 0.
+ */
+int smarc_fresample_flush_f(struct FFilter*, struct FState*,
+		float* output,
+		int outputFrames);
+
 #ifdef __cplusplus
 }
 #endif
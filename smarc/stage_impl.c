@@ -22,6 +22,7 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "smarc.h"
 #include "stage_impl.h"
 #include "filtering.h"
 #include "polyfilt.h"
@@ -33,10 +34,121 @@
 
 #include "remez_lp.h"
 
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
 #define MAX_FILTER_LENGTH 8192
 
+double bessel_i0(double x) {
+	double sum = 1.0;
+	double term = 1.0;
+	for (int k=1;k<64;k++) {
+		const double t = x / (2.0*k);
+		term *= t*t;
+		sum += term;
+		if (term < sum*1e-17)
+			break;
+	}
+	return sum;
+}
+
+double kaiser_beta(double rs) {
+	if (rs>50)
+		return 0.1102*(rs-8.7);
+	if (rs>21)
+		return 0.5842*pow(rs-21,0.4) + 0.07886*(rs-21);
+	return 0;
+}
+
+// Kaiser windowed sinc of length len with cutoff fc, and a window shape giving
+// an attenuation of att dB
+static void kaiser_lp(double* h, int len, double fc, double att) {
+	const double beta = kaiser_beta(att);
+	const double i0beta = bessel_i0(beta);
+	const double half = 0.5 * (len - 1);
+	for (int i=0;i<len;i++) {
+		const double x = i - half;
+		const double r = x / half;
+		const double sinc = x==0 ? 2*fc : sin(2*M_PI*fc*x) / (M_PI*x);
+		h[i] = sinc * bessel_i0(beta*sqrt(fmax(0.0,1-r*r))) / i0beta;
+	}
+}
+
+// filter length rounded up to a multiple of SMARC_FILTER_PAD
+static int padded_length(int n) {
+	return (n + SMARC_FILTER_PAD - 1) / SMARC_FILTER_PAD * SMARC_FILTER_PAD;
+}
+
+// Kaiser estimate of the length of a filter with a transition band of width
+// df and an attenuation of att dB
+static int kaiser_order(double att, double df) {
+	return (int) ceil((att - 7.95) / (14.36 * df)) + 1;
+}
+
+#define FOLD_MIN_TAPS 64
+
+// multiplies of a stage filtered in direct form, per output of a decimation
+// and per two outputs of an interpolation: a plain filter of n taps,
+// folded from FOLD_MIN_TAPS taps for decimation as init_folded does, or a
+// half-band filter with 2m side taps, folded as init_halfband does
+static int plain_stage_taps(int n, int decimation) {
+	if (!decimation)
+		return 2 * padded_length((n + 1) / 2);
+	return n>=FOLD_MIN_TAPS ? padded_length((n + 1) / 2) : padded_length(n);
+}
+
+static int halfband_stage_taps(int m) {
+	return 1 + (padded_length(m) <= 2*m ? padded_length(m) : padded_length(2*m));
+}
+
+// Design a half-band filter: its bands are symmetric about 0.25 and have the
+// same ripple, so that every other coefficient but the center one is zero.
+// The passband extends to hfpass = max(fpass,0.5-fstop) for the bands to be
+// symmetric, and both bands take the smaller ripple. The filter is designed
+// only if it takes fewer multiplies than a plain filter of length n, returns
+// 0 otherwise. Its side taps are symmetric and folded, so this holds for the
+// intermediate stages of power-of-two conversions, twice as long as a plain
+// filter, but not for the last stage of a decimation to fsout/2 (nor the
+// first of an interpolation from fsin): its stopband starts at 0.25, where
+// a half-band filter is at -6dB.
+// The filter has a core of 4m-1 taps, plus a zero at both ends so that its
+// length 4m+1 suits 2:1 and 1:2 stages alike.
+static int build_halfband_filter(double fpass, double fstop, const double* dev,
+		int design, int n, int decimation, double** h, int* len) {
+	const double hfpass = fmax(fpass, 0.5 - fstop);
+	if (hfpass >= 0.25)
+		return 0;
+
+	double bands[4] = { 0, hfpass, 0.5 - hfpass, 0.5 };
+	const double mag[2] = { 1, 0 };
+	const double hdev[2] = { fmin(dev[0],dev[1]), fmin(dev[0],dev[1]) };
+	double weight[2];
+	const double att = -20 * log10(hdev[0]);
+	const int hn = design==SMARC_DESIGN_KAISER ? kaiser_order(att, 0.5 - 2*hfpass)
+			: remez_lp_order(bands, mag, hdev, weight);
+	const int m = (hn + 4) / 4;
+	if (halfband_stage_taps(m) >= plain_stage_taps(n,decimation) || 4*m + 1 > MAX_FILTER_LENGTH)
+		return 0;
+
+	*len = 4*m + 1;
+	*h = calloc(*len, sizeof(double));
+	if (design==SMARC_DESIGN_KAISER) {
+		kaiser_lp(*h + 1, 4*m - 1, 0.25, att);
+	} else if (remez_lp(*h + 1, 4*m - 1, bands, (double*) mag, weight)) {
+		free(*h);
+		return 0;
+	}
+	// both designs give zeros there up to rounding, make them exact
+	const int center = 2*m;
+	for (int i=2;i<*len-2;i+=2)
+		(*h)[i] = 0;
+	(*h)[center] = 0.5;
+	return 1;
+}
+
 void build_filter(double fpass, double fstop,
-		double rp, double rs, int rpFactor, double** h, int* len, int lenStep) {
+		double rp, double rs, int rpFactor, int design, int halfband, double** h, int* len, int lenStep) {
 	int i;
 	double *bands, *mag, *dev, *weight;
 
@@ -58,7 +170,19 @@ void build_filter(double fpass, double fstop,
 	dev[0] = (pow(10, rp / 20.0) - 1) / (rpFactor *(pow(10, rp / 20.0) + 1));
 	dev[1] = pow(10, -rs / 20.0);
 
-	int n = remez_lp_order(bands, mag, dev, weight);
+	// a Kaiser window gives the same ripple in both bands: the smaller one
+	const double att = -20 * log10(fmin(dev[0],dev[1]));
+	int n;
+	if (design==SMARC_DESIGN_KAISER) {
+		n = kaiser_order(att, fstop - fpass);
+	} else {
+		n = remez_lp_order(bands, mag, dev, weight);
+	}
+
+	if (halfband && build_halfband_filter(fpass, fstop, dev, design, n, lenStep==2, h, len)) {
+		free(bands);
+		return;
+	}
 
 	// filter length must be 2*K*lenStep+1 so that delay is integer
 	{
@@ -72,14 +196,19 @@ void build_filter(double fpass, double fstop,
 	{
 		free(bands);
 		*len = 0;
-		printf("ERROR: cannot build remez filter, it's too long ! (%i) try with other parameters\n",n);
+		printf("ERROR: cannot build filter, it's too long ! (%i) try with other parameters\n",n);
 		return;
 	}
 
 	*h = malloc((*len) * sizeof(double));
-	for (i = 0; i < *len; i++)
-		(*h)[i] = 0;
-	int iRc = remez_lp(*h, *len, bands, mag, weight);
+	int iRc = 0;
+	if (design==SMARC_DESIGN_KAISER) {
+		kaiser_lp(*h, *len, 0.5 * (fpass + fstop), att);
+	} else {
+		for (i = 0; i < *len; i++)
+			(*h)[i] = 0;
+		iRc = remez_lp(*h, *len, bands, mag, weight);
+	}
 	if (iRc)
 	{
 		free(*h);
@@ -90,14 +219,191 @@ void build_filter(double fpass, double fstop,
 	free(bands);
 }
 
+// copy the L sub-filters of length srcK in src (the last ceil(flen/L)
+// coefficients of each are the filter taps) into pfilt->filters, padded at
+// their start with zeros so that each has a length multiple of
+// SMARC_FILTER_PAD and starts aligned. Padding only extends the filter with
+// zero taps, so the filter and its delay are unchanged.
+static void init_padded_filters(struct PSFilter* pfilt, const double* src, int srcK) {
+	const int L = pfilt->L;
+	const int taps = (pfilt->flen + L - 1) / L;
+	const int K = padded_length(taps);
+	pfilt->K = K;
+	pfilt->lead = K - taps;
+	pfilt->kernel = filter_padded_kernel(K);
+	pfilt->kernel_f = filter_padded_kernel_f(K);
+	pfilt->filters = smarc_aligned_malloc((size_t)L*K*sizeof(double));
+	for (int l=0;l<L;l++) {
+		double* phase = pfilt->filters + (size_t)l*K;
+		for (int k=0;k<pfilt->lead;k++)
+			phase[k] = 0.0;
+		memcpy(phase + pfilt->lead,src + (size_t)l*srcK + srcK - taps,taps*sizeof(double));
+	}
+}
+
+// fold the n side taps of a half-band filter, every step coefficients from h,
+// if they are symmetric and folding leaves fewer padded taps, as init_folded
+static void fold_halfband(struct PHalfBand* hb, const double* h, int step) {
+	const int n = hb->n;
+	hb->half = (n + 1) / 2;
+	hb->H = padded_length(hb->half);
+	hb->fold = NULL;
+	hb->fold_f = NULL;
+	if (n<2 || hb->H>n) {
+		hb->H = 0;
+		return;
+	}
+	double peak = 0.0;
+	for (int i=0;i<n;i++)
+		if (fabs(h[i*step])>peak)
+			peak = fabs(h[i*step]);
+	for (int i=0;i<n/2;i++)
+		if (fabs(h[i*step] - h[(n-1-i)*step])>1e-9*peak) {
+			hb->H = 0;
+			return;
+		}
+
+	hb->fold = smarc_aligned_malloc(hb->H*sizeof(double));
+	hb->fold_f = smarc_aligned_malloc(hb->H*sizeof(float));
+	for (int i=0;i<hb->H;i++) {
+		if (i<n/2)
+			hb->fold[i] = 0.5 * (h[i*step] + h[(n-1-i)*step]);
+		else if (i<hb->half)
+			hb->fold[i] = 0.5 * h[i*step];
+		else
+			hb->fold[i] = 0.0;
+		hb->fold_f[i] = (float) hb->fold[i];
+	}
+}
+
+// set pfilt->halfband if pfilt is a 2:1 or 1:2 half-band filter, which is
+// recognized from its coefficients so that saved filters are too
+static void init_halfband(struct PSFilter* pfilt) {
+	pfilt->halfband = NULL;
+	if (pfilt->L * pfilt->M != 2)
+		return;
+
+	const int K = pfilt->K;
+	struct PHalfBand hb;
+	if (pfilt->L==2) {
+		// the center coefficient is alone in one of the two sub-filters
+		hb.phase = -1;
+		for (int l=0;l<2 && hb.phase<0;l++) {
+			int nonzero = 0;
+			for (int k=0;k<K;k++)
+				if (pfilt->filters[l*K+k]!=0) {
+					nonzero++;
+					hb.pos = k;
+				}
+			if (nonzero==1)
+				hb.phase = l;
+		}
+		if (hb.phase<0)
+			return;
+		// the side taps are the non zero span of the other sub-filter
+		const double* side = pfilt->filters + (1 - hb.phase)*K;
+		int last = K - 1;
+		hb.first = 0;
+		while (hb.first<K && side[hb.first]==0)
+			hb.first++;
+		while (last>hb.first && side[last]==0)
+			last--;
+		hb.n = last - hb.first + 1;
+		hb.K = 0;
+	} else {
+		// odd length filter whose coefficients at even distance of the center are zero
+		const int taps = K - pfilt->lead;
+		if (taps%2==0)
+			return;
+		hb.phase = 0;
+		hb.pos = pfilt->lead + taps/2;
+		for (int k=pfilt->lead;k<K;k++)
+			if ((k - hb.pos)%2==0 && k!=hb.pos && pfilt->filters[k]!=0)
+				return;
+		hb.first = pfilt->lead + ((taps/2)%2==0 ? 1 : 0);
+		hb.n = (K - hb.first + 1) / 2;
+		hb.K = padded_length(hb.n);
+	}
+	hb.center = pfilt->filters[hb.phase*K + hb.pos];
+	hb.taps = NULL;
+	hb.taps_f = NULL;
+	hb.kernel = filter_padded_kernel(hb.K);
+	hb.kernel_f = filter_padded_kernel_f(hb.K);
+	if (hb.K>0) {
+		hb.taps = smarc_aligned_malloc(hb.K*sizeof(double));
+		hb.taps_f = smarc_aligned_malloc(hb.K*sizeof(float));
+		for (int i=0;i<hb.K;i++) {
+			hb.taps[i] = i<hb.n ? pfilt->filters[hb.first + 2*i] : 0.0;
+			hb.taps_f[i] = (float) hb.taps[i];
+		}
+	}
+	if (pfilt->L==2)
+		fold_halfband(&hb,pfilt->filters + (1 - hb.phase)*K + hb.first,1);
+	else
+		fold_halfband(&hb,pfilt->filters + hb.first,2);
+	pfilt->halfband = malloc(sizeof(struct PHalfBand));
+	*pfilt->halfband = hb;
+}
+
+// set pfilt->folded if pfilt is a symmetric decimation filter of at least
+// FOLD_MIN_TAPS taps: the pre-additions and reversals of the folded kernels
+// do not pay off on shorter ones. Designed filters are linear phase, so this
+// holds for all but half-band filters (filtered by polyfiltHB); mirrored taps
+// equal to rounding are averaged.
+
+static void init_folded(struct PSFilter* pfilt) {
+	pfilt->folded = NULL;
+	if (pfilt->L!=1 || pfilt->halfband)
+		return;
+
+	const int n = pfilt->K - pfilt->lead;
+	const double* h = pfilt->filters + pfilt->lead;
+	const int half = (n + 1) / 2;
+	const int H = padded_length(half);
+	if (n<FOLD_MIN_TAPS || H>n)
+		return;
+	double peak = 0.0;
+	for (int k=0;k<n;k++)
+		if (fabs(h[k])>peak)
+			peak = fabs(h[k]);
+	for (int k=0;k<n/2;k++)
+		if (fabs(h[k] - h[n-1-k])>1e-9*peak)
+			return;
+
+	struct PFolded* fold = malloc(sizeof(struct PFolded));
+	fold->n = n;
+	fold->half = half;
+	fold->H = H;
+	fold->taps = smarc_aligned_malloc(H*sizeof(double));
+	fold->taps_f = smarc_aligned_malloc(H*sizeof(float));
+	for (int k=0;k<H;k++) {
+		if (k<n/2)
+			fold->taps[k] = 0.5 * (h[k] + h[n-1-k]);
+		else if (k<half)
+			fold->taps[k] = 0.5 * h[k];
+		else
+			fold->taps[k] = 0.0;
+		fold->taps_f[k] = (float) fold->taps[k];
+	}
+	pfilt->folded = fold;
+}
+
+// single precision copy of the filters, used to resample float signals
+static void init_float_filters(struct PSFilter* pfilt) {
+	const int n = pfilt->L * pfilt->K;
+	pfilt->filters_f = smarc_aligned_malloc(n*sizeof(float));
+	for (int i=0;i<n;i++)
+		pfilt->filters_f[i] = (float) pfilt->filters[i];
+}
+
 struct PSFilter* init_psfilter(int L, int M,
 		double fpass, double fstop,
-		double rp, double rs, int rpFactor) {
+		double rp, double rs, int rpFactor, int design) {
 
 	double* h = 0;
 	int Lenh;
 
-	build_filter(fpass,fstop,rp, rs, rpFactor, &h, &Lenh,M);
+	build_filter(fpass,fstop,rp, rs, rpFactor, design, L*M==2, &h, &Lenh,M);
 	if (Lenh==0)
 	{
 		printf("ERROR: cannot build filter %i/%i (within a %i stage filter) with parameters fpass=%0.2f fstop=%0.2f rp=%0.2f rs=%0.2f\n",L,M,rpFactor, fpass,fstop,rp,rs);
@@ -119,20 +425,20 @@ struct PSFilter* init_psfilter(int L, int M,
 	int K = Lenh / L;
 	if (Lenh > K*L)
 		K++;
-	pfilt->filters = malloc(L*K*sizeof(double));
+	double* filters = malloc(L*K*sizeof(double));
 
 	if (L==1)
 	{
 		// decimation filter (only one filter)
 		for (int k=0;k<K;k++)
-			pfilt->filters[K-1-k] = h[k];
+			filters[K-1-k] = h[k];
 	} else {
 		// filter with interpolation (one filter per interpolation tap)
 		for (int i=0;i<L;i++)
-			pfilt->filters[i*K] = 0.0;
+			filters[i*K] = 0.0;
 		for (int i=0;i<Lenh;i++)
 		{
-			pfilt->filters[(i%L)*K+K-1-i/L] = h[i];
+			filters[(i%L)*K+K-1-i/L] = h[i];
 		}
 	}
 
@@ -141,14 +447,96 @@ struct PSFilter* init_psfilter(int L, int M,
 	pfilt->flen = Lenh;
 	pfilt->M = M;
 	pfilt->L = L;
-	pfilt->K = K;
 	pfilt->filter_delay = (Lenh - 1) / (2*M);
+	init_padded_filters(pfilt,filters,K);
+	free(filters);
+	init_float_filters(pfilt);
+	init_halfband(pfilt);
+	init_folded(pfilt);
+	pfilt->fft = L==1 ? init_fftfilter(pfilt->filters,pfilt->K,M) : NULL;
+
+	return pfilt;
+}
+
+#define PSFILTER_MAGIC 0x31465350 // "PSF1"
+
+int save_psfilter(const struct PSFilter* pfilt, FILE* f) {
+	const int header[6] = { PSFILTER_MAGIC, pfilt->flen, pfilt->L, pfilt->M, pfilt->K, pfilt->filter_delay };
+	if (fwrite(header, sizeof(int), 6, f) != 6)
+		return -1;
+	const size_t n = (size_t) pfilt->L * pfilt->K;
+	if (fwrite(pfilt->filters, sizeof(double), n, f) != n)
+		return -1;
+	return 0;
+}
+
+struct PSFilter* load_psfilter(FILE* f) {
+	int header[6];
+	if (fread(header, sizeof(int), 6, f) != 6 || header[0] != PSFILTER_MAGIC)
+		return NULL;
+	if (header[1] <= 0 || header[2] <= 0 || header[3] <= 0 || header[4] <= 0)
+		return NULL;
+
+	// files may be shared with other processes: reject what build_filter
+	// cannot produce, a filter of at most MAX_FILTER_LENGTH taps rounded up
+	// to 2*k*M+1 and at least L+M-1 taps long
+	const int flen = header[1];
+	const int L = header[2];
+	const int M = header[3];
+	const int K = header[4];
+	if (L > MAX_FILTER_LENGTH || M > MAX_FILTER_LENGTH || K > MAX_FILTER_LENGTH
+			|| flen > MAX_FILTER_LENGTH + 2*M || flen < L + M - 1
+			|| header[5] != (flen - 1) / (2*M))
+		return NULL;
+	// files store sub-filters padded or not: each must hold the filter taps
+	const int taps = (flen + L - 1) / L;
+	if (K < taps || K > padded_length(taps))
+		return NULL;
 
+	const size_t n = (size_t) L * K;
+	double* filters = malloc(n*sizeof(double));
+	if (filters == NULL)
+		return NULL;
+	if (fread(filters, sizeof(double), n, f) != n) {
+		free(filters);
+		return NULL;
+	}
+
+	struct PSFilter* pfilt = malloc(sizeof(struct PSFilter));
+	if (pfilt == NULL) {
+		free(filters);
+		return NULL;
+	}
+	pfilt->flen = flen;
+	pfilt->L = L;
+	pfilt->M = M;
+	pfilt->filter_delay = header[5];
+	init_padded_filters(pfilt,filters,K);
+	free(filters);
+	init_float_filters(pfilt);
+	init_halfband(pfilt);
+	init_folded(pfilt);
+	pfilt->fft = L==1 ? init_fftfilter(pfilt->filters,pfilt->K,pfilt->M) : NULL;
 	return pfilt;
 }
 
 void destroy_psfilter(struct PSFilter* pfilt) {
-	free(pfilt->filters);
+	smarc_aligned_free(pfilt->filters);
+	smarc_aligned_free(pfilt->filters_f);
+	if (pfilt->fft)
+		destroy_fftfilter(pfilt->fft);
+	if (pfilt->halfband) {
+		smarc_aligned_free(pfilt->halfband->taps);
+		smarc_aligned_free(pfilt->halfband->taps_f);
+		smarc_aligned_free(pfilt->halfband->fold);
+		smarc_aligned_free(pfilt->halfband->fold_f);
+		free(pfilt->halfband);
+	}
+	if (pfilt->folded) {
+		smarc_aligned_free(pfilt->folded->taps);
+		smarc_aligned_free(pfilt->folded->taps_f);
+		free(pfilt->folded);
+	}
 	free(pfilt);
 }
 
@@ -156,15 +544,25 @@ struct PSState* init_psstate(struct PSFilter* pfilt) {
 	struct PSState* pstate = (struct PSState*) malloc(sizeof(struct PSState));
 	pstate->skip = 0;
 	pstate->phase = 0;
+	pstate->use_fft = 0;
+	pstate->fft_work = NULL;
+	pstate->fft_out = NULL;
+	pstate->hb_work = NULL;
 	reset_psstate(pstate,pfilt);
 	return pstate;
 }
 
 void destroy_psstate(struct PSState* pstate) {
+	free(pstate->fft_work);
+	free(pstate->fft_out);
+	smarc_aligned_free(pstate->hb_work);
 	free(pstate);
 }
 
 void reset_psstate(struct PSState* pstate, const struct PSFilter* pfilt) {
 	pstate->skip=pfilt->filter_delay;
 	pstate->phase = 0;
+	pstate->partial = 0;
+	pstate->fft_next = 0;
+	pstate->fft_pending = 0;
 }
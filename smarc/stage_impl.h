@@ -26,26 +26,92 @@
 #define POLYPHASE_DECL_H_
 
 #include "filtering.h"
+#include "fftfilt.h"
+#include <stdio.h>
 
 #define FILT(pfilt,m,l) &pfilt->filters[(m*L+l)*K]
 #define FILT_STATE(pstate,m) &pstate->yi[m*(K-1)]
 
+/**
+ * Half-band filter of a 2:1 or 1:2 stage: every other coefficient is zero but
+ * the center one, so one of the two polyphase components is that coefficient
+ * alone. It is filtered without multiplying through the zeros, and its other
+ * non zero coefficients (side taps) are symmetric, so they are folded as
+ * PFolded taps are.
+ * - center: center coefficient
+ * - phase: sub-filter holding the center coefficient (always 0 for decimation)
+ * - pos: index of the center coefficient in its sub-filter
+ * - first: index of the first side tap, in the sub-filter for decimation, in the other sub-filter for interpolation
+ * - n: number of side taps, every other coefficient from first for decimation, contiguous for interpolation
+ * - K: for decimation, n rounded up to a multiple of SMARC_FILTER_PAD
+ * - taps, taps_f: for decimation, the n side taps followed by K-n zeros, aligned as filters
+ * - kernel, kernel_f: filter_padded kernels for the K taps, from filter_padded_kernel
+ * - half: number of folded side taps, (n+1)/2
+ * - H: half rounded up to a multiple of SMARC_FILTER_PAD, 0 if the side taps are not folded
+ * - fold, fold_f: the side taps folded for filter_folded, NULL if they are not folded
+ */
+struct PHalfBand {
+	double center;
+	int phase;
+	int pos;
+	int first;
+	int n;
+	int K;
+	double* taps;
+	float* taps_f;
+	FilterFunc kernel;
+	FilterFuncF kernel_f;
+	int half;
+	int H;
+	double* fold;
+	float* fold_f;
+};
+
+/**
+ * Symmetric decimation filter (L=1) folded for filter_folded: mirrored taps
+ * are equal, so each pair of samples they meet is added before one multiply.
+ * - n: number of taps, starting at index lead of the sub-filter
+ * - half: number of folded coefficients, (n+1)/2
+ * - H: half rounded up to a multiple of SMARC_FILTER_PAD
+ * - taps, taps_f: the first half coefficients, the center one halved when n is odd, followed by H-half zeros, aligned as filters
+ */
+struct PFolded {
+	int n;
+	int half;
+	int H;
+	double* taps;
+	float* taps_f;
+};
+
 /**
  * Defines a filter stage.
  * - flen: length of remez filter. (L*M*K)
  * - L: interpolation factor
  * - M: decimation factor
- * - K: sub-filter length
- * - filters: array of L*M sub filters of length K. (total size is flen)
+ * - K: sub-filter length, padded to a multiple of SMARC_FILTER_PAD
+ * - lead: number of zero coefficients padding the start of each sub-filter
+ * - filters: array of L sub filters of length K, aligned on SMARC_FILTER_ALIGN bytes
+ * - filters_f: filters in single precision, for float signals, aligned as filters
+ * - kernel, kernel_f: filter_padded kernels for sub-filters of K taps, from filter_padded_kernel
+ * - fft: FFT implementation of a decimation filter (L=1), NULL if it is filtered in direct form
+ * - halfband: half-band structure of a 2:1 or 1:2 filter, NULL if it is not a half-band filter
+ * - folded: folded symmetric decimation filter, NULL if the filter is not folded
  */
 struct PSFilter {
 	int flen;
 	int L;
 	int M;
 	int K;
+	int lead;
 
 	double* filters;
+	float* filters_f;
+	FilterFunc kernel;
+	FilterFuncF kernel_f;
 	int filter_delay;
+	struct PFFTFilter* fft;
+	struct PHalfBand* halfband;
+	struct PFolded* folded;
 };
 
 /**
@@ -57,28 +123,67 @@ struct PSFilter {
  * - rp [IN]: accepted ripple factor in pass band (in dB) within global structure.
  * - rs [IN]: accepted ripple factor in stop band (in dB)
  * - rpFactor [IN]: number of stage in global structure.
+ * - design [IN]: filter design method, a smarc_design value
+ *
+ * 2:1 and 1:2 stages are designed as half-band filters when this takes fewer
+ * multiplies.
  *
  * Return pointer to PSFilter struct. This pointer must be deleted using destroy_psfilter function.
  */
 struct PSFilter* init_psfilter(int L, int M,
 		double fpass, double fstop,
-		double rp, double rs, int rpFactor);
+		double rp, double rs, int rpFactor, int design);
+
+/**
+ * Zeroth order modified Bessel function of the first kind, used by Kaiser windows
+ */
+double bessel_i0(double x);
+
+/**
+ * Kaiser window shape parameter giving a stopband attenuation of rs dB
+ */
+double kaiser_beta(double rs);
 
 /**
  * Destroy PSFilter, release memory
  */
 void destroy_psfilter(struct PSFilter*);
 
+/**
+ * Write PSFilter to binary file f.
+ * Return 0 if success -1 if failed
+ */
+int save_psfilter(const struct PSFilter* pfilt, FILE* f);
+
+/**
+ * Read a PSFilter written by save_psfilter from binary file f.
+ * Return NULL if the file does not contain a valid PSFilter. The returned pointer must be deleted using destroy_psfilter function.
+ */
+struct PSFilter* load_psfilter(FILE* f);
+
 /**
  * Defines a filter stage state.
  * - inbuf: input buffer
  * - inbuf_size: input buffer allocated size
  * - available: available samples in inbuf
  * - skip: number of samples to skip (used to handle filter delay)
+ * - use_fft: filter with the FFT implementation of the filter, when it is faster for the signal type
+ * - partial: filter input that does not fill an FFT block in direct form (set while flushing)
+ * - fft_work: FFT workspace, allocated on first use
+ * - fft_out: outputs of the last FFT block, B frames of doubles allocated on first use
+ * - fft_next, fft_pending: first fft_out frame not written yet, and number of such frames
+ * - hb_work: half-band decimation workspace, allocated on first use
  */
 struct PSState {
 	int skip;
 	int phase;
+	int use_fft;
+	int partial;
+	double* fft_work;
+	double* fft_out;
+	int fft_next;
+	int fft_pending;
+	void* hb_work;
 };
 
 /**
@@ -5,6 +5,7 @@
 
 
 #include "xdf.h"
+#include "resampling.h"
 
 #include <iostream>
 #include <fstream>
@@ -16,12 +17,292 @@
 #include <numeric>      //std::accumulate
 #include <functional>   // bind2nd
 #include <cmath>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <optional>
+#include <utility>
+
+namespace
+{
+//call fn(i) for every i in [0, count) on up to `threads` worker threads (0 = one per hardware thread).
+//Workers pull the next index from a shared counter, so a few large items don't leave the other threads idle.
+template<typename Function>
+void parallelFor(size_t count, unsigned int threads, Function fn)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    if (threads > count)
+        threads = count;
+
+    if (threads <= 1)
+    {
+        for (size_t i = 0; i < count; i++)
+            fn(i);
+        return;
+    }
+
+    std::atomic<size_t> next{ 0 };
+    std::exception_ptr error;
+    std::mutex errorMutex;
+
+    auto worker = [&]()
+    {
+        for (size_t i = next++; i < count; i = next++)
+        {
+            try
+            {
+                fn(i);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned int t = 1; t < threads; t++)
+        pool.emplace_back(worker);
+    worker();
+    for (auto &thread : pool)
+        thread.join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+//append `count` deduced time stamps to a stream. Each one is computed from the last explicit
+//time stamp as anchor + k * interval rather than by adding the interval to its predecessor,
+//so rounding errors don't accumulate over long runs and the loop has no serial dependency.
+void appendDeducedTimeStamps(Xdf::Stream &stream, uint64_t count)
+{
+    if (count == 0)
+        return;
+
+    std::vector<double> &timeStamps = stream.time_stamps;
+    const size_t begin = timeStamps.size();
+    timeStamps.resize(begin + count);
+
+    double* ts = timeStamps.data() + begin;
+    const double anchor = stream.last_timestamp;
+    const double interval = stream.sampling_interval;
+    const double first = stream.deduced_count + 1.0;
+
+    for (uint64_t k = 0; k < count; k++)
+        ts[k] = anchor + (first + k) * interval;
+
+    stream.deduced_count += count;
+}
+
+//runs tasks in submission order on a background thread, so that work on decoded
+//data overlaps with reading the file. submit() blocks while `capacity` tasks are
+//waiting, which bounds the memory they hold. Without a thread, tasks run in submit().
+//Errors of the tasks are kept for finish() either way.
+class SerialWorker
+{
+public:
+    SerialWorker(bool threaded, size_t capacity)
+        : capacity(capacity)
+    {
+        if (threaded)
+            thread = std::thread([this]() { run(); });
+    }
+
+    ~SerialWorker()
+    {
+        try
+        {
+            finish();
+        }
+        catch (...)
+        {
+        }
+    }
+
+    void submit(std::function<void()> task)
+    {
+        if (!thread.joinable())
+        {
+            try
+            {
+                if (!error)
+                    task();
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&]() { return tasks.size() < capacity; });
+        tasks.push_back(std::move(task));
+        changed.notify_all();
+    }
+
+    //wait for all submitted tasks and rethrow the first error of any of them
+    void finish()
+    {
+        if (thread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                done = true;
+            }
+            changed.notify_all();
+            thread.join();
+        }
+        if (error)
+            std::rethrow_exception(std::exchange(error, nullptr));
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            changed.wait(lock, [&]() { return done || !tasks.empty(); });
+            if (tasks.empty())
+                return;
+            std::function<void()> task = std::move(tasks.front());
+            tasks.pop_front();
+            changed.notify_all();
+
+            lock.unlock();
+            try
+            {
+                //after an error, the remaining tasks are only drained
+                if (!error)
+                    task();
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            lock.lock();
+        }
+    }
+
+    size_t capacity;
+    std::deque<std::function<void()> > tasks;
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool done = false;
+    std::exception_ptr error;
+    std::thread thread;
+};
+
+//resamples the interleaved frames of one stream block by block as they are
+//decoded, keeping only the output rows. The filter is designed on the first
+//block, so that the design too runs on the worker rather than the reader.
+class StreamResampler
+{
+public:
+    StreamResampler(double fsin, int fsout, int channels, const ResampleSpec &spec)
+        : fsin(fsin), fsout(fsout), channels(channels), spec(spec)
+    {
+        rows.resize(channels);
+    }
+
+    //frames in blocks of up to blockFrames() frames
+    void process(const std::vector<float> &frames)
+    {
+        if (!resampler)
+            resampler.emplace(fsin, fsout, channels, spec);
+        const int count = (int) (frames.size() / channels);
+        if (!resampler->valid())
+        {
+            //the filter cannot be designed; keep the stream at its rate, as resample() does
+            appendFrames(frames.data(), count);
+            return;
+        }
+        outbuf.resize(resampler->outputFrames(count) * channels);
+        appendFrames(outbuf.data(), (int) resampler->process(frames, outbuf));
+    }
+
+    void flush()
+    {
+        if (!resampler)
+            resampler.emplace(fsin, fsout, channels, spec);
+        if (!resampler->valid())
+            return;
+        outbuf.resize(resampler->outputFrames(blockFrames()) * channels);
+        int count;
+        while ((count = (int) resampler->flush(outbuf)) > 0)
+            appendFrames(outbuf.data(), count);
+    }
+
+    //whether the stream was resampled, false if its filter cannot be designed
+    bool valid() const
+    {
+        return resampler && resampler->valid();
+    }
+
+    //about 64 KB of interleaved samples, as in Xdf::resample()
+    int blockFrames() const
+    {
+        return std::max(512, 16384 / channels);
+    }
+
+    std::vector<std::vector<float> > rows;
+
+private:
+    void appendFrames(const float* frames, int count)
+    {
+        for (int ch = 0; ch < channels; ch++)
+        {
+            std::vector<float> &row = rows[ch];
+            const size_t offset = row.size();
+            row.resize(offset + count);
+            for (int i = 0; i < count; i++)
+                row[offset + i] = frames[(size_t) i * channels + ch];
+        }
+    }
+
+    double fsin;
+    int fsout;
+    int channels;
+    ResampleSpec spec;
+    std::optional<Resampler> resampler;     //created on the first block
+    std::vector<float> outbuf;
+};
+
+//replace the time stamps of a stream resampled by StreamResampler by those of
+//its output samples: output m sits at input position m * step
+void resampleTimeStamps(Xdf::Stream &stream, double step, size_t count)
+{
+    const std::vector<double> &ts = stream.time_stamps;
+    std::vector<double> resampled(count);
+    for (size_t m = 0; m < count && !ts.empty(); m++)
+    {
+        const double position = m * step;
+        const size_t i = std::min((size_t) position, ts.size() - 1);
+        const size_t next = std::min(i + 1, ts.size() - 1);
+        const double interval = next > i ? ts[next] - ts[i] : stream.sampling_interval;
+        resampled[m] = ts[i] + (position - i) * interval;
+    }
+    stream.time_stamps.swap(resampled);
+}
+}
 
 Xdf::Xdf()
 {
 }
 
-int Xdf::load_xdf(std::string filename)
+int Xdf::load_xdf(std::string filename, bool dejitter)
+{
+    return load_xdf(filename, dejitter, 0);
+}
+
+int Xdf::load_xdf(std::string filename, bool dejitter, int userSrate, const ResampleSpec &spec)
 {
     clock_t time;
     time = clock();
@@ -39,6 +320,14 @@ int Xdf::load_xdf(std::string filename)
 
     std::vector<int> idmap; //remaps stream id's onto indices in streams
 
+    //with a target rate, numeric streams at other rates are resampled as they are
+    //decoded: the Samples chunks fill a block of interleaved frames per stream, and
+    //full blocks are resampled on a worker while the next chunks are read. The
+    //worker is started with the first resampled stream
+    std::vector<std::unique_ptr<StreamResampler> > resamplers;
+    std::vector<std::vector<float> > pending;
+    std::optional<SerialWorker> worker;
+
 
     //===================================================================
     //========================= parse the file ==========================
@@ -165,223 +454,36 @@ int Xdf::load_xdf(std::string filename)
                 //read [NumSampleBytes], [NumSamples]
                 uint64_t numSamp = readLength(file);
 
-                //check the data type
-                if (streams[index].info.channel_format.compare("float32") == 0)
+                const Stream &stream = streams[index];
+                if (resamplers.size() < streams.size())
                 {
-                    //if the time series is empty
-                    if (streams[index].time_series.empty())
-                        streams[index].time_series.resize(streams[index].info.channel_count);
-
-                    //for each sample
-                    for (size_t i = 0; i < numSamp; i++)
-                    {
-                        //read or deduce time stamp
-                        auto tsBytes = readBin<uint8_t>(file);
-
-                        double ts;  //temporary time stamp
-
-                        if (tsBytes == 8)
-                        {
-                            Xdf::readBin(file, &ts);
-                            streams[index].time_stamps.emplace_back(ts);
-                        }
-                        else
-                        {
-                            ts = streams[index].last_timestamp + streams[index].sampling_interval;
-                            streams[index].time_stamps.emplace_back(ts);
-                        }
-
-                        streams[index].last_timestamp = ts;
-
-                        //read the data
-                        for (int v = 0; v < streams[index].info.channel_count; ++v)
-                        {
-                            float data;
-                            Xdf::readBin(file, &data);
-                            streams[index].time_series[v].emplace_back(data);
-                        }
-                    }
+                    resamplers.resize(streams.size());
+                    pending.resize(streams.size());
                 }
-                else if (streams[index].info.channel_format.compare("double64") == 0)
+                if (userSrate > 0 && !resamplers[index] && stream.time_series.empty() &&
+                        stream.info.channel_format.compare("string") && stream.info.channel_count > 0 &&
+                        stream.info.nominal_srate > 0 && stream.info.nominal_srate != userSrate)
                 {
-                    //if the time series is empty
-                    if (streams[index].time_series.empty())
-                        streams[index].time_series.resize(streams[index].info.channel_count);
-
-                    //for each sample
-                    for (size_t i = 0; i < numSamp; i++)
-                    {
-                        //read or deduce time stamp
-                        auto tsBytes = readBin<uint8_t>(file);
-
-                        double ts;  //temporary time stamp
-
-                        if (tsBytes == 8)
-                        {
-                            Xdf::readBin(file, &ts);
-                            streams[index].time_stamps.emplace_back(ts);
-                        }
-                        else
-                        {
-                            ts = streams[index].last_timestamp + streams[index].sampling_interval;
-                            streams[index].time_stamps.emplace_back(ts);
-                        }
-
-                        streams[index].last_timestamp = ts;
-
-                        //read the data
-                        for (int v = 0; v < streams[index].info.channel_count; ++v)
-                        {
-                            double data;
-                            Xdf::readBin(file, &data);
-                            streams[index].time_series[v].emplace_back(data);
-                        }
-                    }
+                    resamplers[index] = std::make_unique<StreamResampler>(stream.info.nominal_srate, userSrate,
+                                                                          stream.info.channel_count, spec);
+                    if (!worker)
+                        worker.emplace(threadCount != 1, 4);
                 }
-                else if (streams[index].info.channel_format.compare("int8") == 0)
-                {
-                    //if the time series is empty
-                    if (streams[index].time_series.empty())
-                        streams[index].time_series.resize(streams[index].info.channel_count);
+                std::vector<float>* frames = resamplers[index] ? &pending[index] : nullptr;
 
-                    //for each sample
-                    for (size_t i = 0; i < numSamp; i++)
-                    {
-                        //read or deduce time stamp
-                        auto tsBytes = readBin<uint8_t>(file);
-
-                        double ts;  //temporary time stamp
-
-                        if (tsBytes == 8)
-                        {
-                            Xdf::readBin(file, &ts);
-                            streams[index].time_stamps.emplace_back(ts);
-                        }
-                        else
-                        {
-                            ts = streams[index].last_timestamp + streams[index].sampling_interval;
-                            streams[index].time_stamps.emplace_back(ts);
-                        }
-
-                        streams[index].last_timestamp = ts;
-
-                        //read the data
-                        for (int v = 0; v < streams[index].info.channel_count; ++v)
-                        {
-                            int8_t data;
-                            Xdf::readBin(file, &data);
-                            streams[index].time_series[v].emplace_back(data);
-                        }
-                    }
-                }
+                //check the data type
+                if (streams[index].info.channel_format.compare("float32") == 0)
+                    readSamples<float>(file, streams[index], numSamp, frames);
+                else if (streams[index].info.channel_format.compare("double64") == 0)
+                    readSamples<double>(file, streams[index], numSamp, frames);
+                else if (streams[index].info.channel_format.compare("int8") == 0)
+                    readSamples<int8_t>(file, streams[index], numSamp, frames);
                 else if (streams[index].info.channel_format.compare("int16") == 0)
-                {
-                    //if the time series is empty
-                    if (streams[index].time_series.empty())
-                        streams[index].time_series.resize(streams[index].info.channel_count);
-
-                    //for each sample
-                    for (size_t i = 0; i < numSamp; i++)
-                    {
-                        //read or deduce time stamp
-                        auto tsBytes = readBin<uint8_t>(file);
-
-                        double ts;  //temporary time stamp
-
-                        if (tsBytes == 8)
-                        {
-                            Xdf::readBin(file, &ts);
-                            streams[index].time_stamps.emplace_back(ts);
-                        }
-                        else
-                        {
-                            ts = streams[index].last_timestamp + streams[index].sampling_interval;
-                            streams[index].time_stamps.emplace_back(ts);
-                        }
-
-                        streams[index].last_timestamp = ts;
-
-                        //read the data
-                        for (int v = 0; v < streams[index].info.channel_count; ++v)
-                        {
-                            int16_t data;
-                            Xdf::readBin(file, &data);
-                            streams[index].time_series[v].emplace_back(data);
-                        }
-                    }
-                }
+                    readSamples<int16_t>(file, streams[index], numSamp, frames);
                 else if (streams[index].info.channel_format.compare("int32") == 0)
-                {
-                    //if the time series is empty
-                    if (streams[index].time_series.empty())
-                        streams[index].time_series.resize(streams[index].info.channel_count);
-
-                    //for each sample
-                    for (size_t i = 0; i < numSamp; i++)
-                    {
-                        //read or deduce time stamp
-                        auto tsBytes = readBin<uint8_t>(file);
-
-                        double ts;  //temporary time stamp
-
-                        if (tsBytes == 8)
-                        {
-                            Xdf::readBin(file, &ts);
-                            streams[index].time_stamps.emplace_back(ts);
-                        }
-                        else
-                        {
-                            ts = streams[index].last_timestamp + streams[index].sampling_interval;
-                            streams[index].time_stamps.emplace_back(ts);
-                        }
-
-                        streams[index].last_timestamp = ts;
-
-                        //read the data
-                        for (int v = 0; v < streams[index].info.channel_count; ++v)
-                        {
-                            int32_t data;
-                            Xdf::readBin(file, &data);
-                            streams[index].time_series[v].emplace_back(data);
-                        }
-                    }
-                }
+                    readSamples<int32_t>(file, streams[index], numSamp, frames);
                 else if (streams[index].info.channel_format.compare("int64") == 0)
-                {
-                    //if the time series is empty
-                    if (streams[index].time_series.empty())
-                        streams[index].time_series.resize(streams[index].info.channel_count);
-
-                    //for each sample
-                    for (size_t i = 0; i < numSamp; i++)
-                    {
-                        //read or deduce time stamp
-                        auto tsBytes = readBin<uint8_t>(file);
-
-                        double ts;  //temporary time stamp
-
-                        if (tsBytes == 8)
-                        {
-                            Xdf::readBin(file, &ts);
-                            streams[index].time_stamps.emplace_back(ts);
-                        }
-                        else
-                        {
-                            ts = streams[index].last_timestamp + streams[index].sampling_interval;
-                            streams[index].time_stamps.emplace_back(ts);
-                        }
-
-                        streams[index].last_timestamp = ts;
-
-                        //read the data
-                        for (int v = 0; v < streams[index].info.channel_count; ++v)
-                        {
-                            int64_t data;
-                            Xdf::readBin(file, &data);
-                            streams[index].time_series[v].emplace_back(data);
-                        }
-                    }
-                }
+                    readSamples<int64_t>(file, streams[index], numSamp, frames);
                 else if (streams[index].info.channel_format.compare("string") == 0)
                 {
                     //for each event
@@ -393,9 +495,14 @@ int Xdf::load_xdf(std::string filename)
                         double ts;  //temporary time stamp
 
                         if (tsBytes == 8)
+                        {
                             Xdf::readBin(file, &ts);
+                            streams[index].last_timestamp = ts;
+                            streams[index].deduced_count = 0;
+                        }
                         else
-                            ts = streams[index].last_timestamp + streams[index].sampling_interval;
+                            ts = streams[index].last_timestamp +
+                                    ++streams[index].deduced_count * streams[index].sampling_interval;
 
                         //read one length-prefixed string per channel: a string
                         //sample contains channel_count values, just like the
@@ -419,9 +526,15 @@ int Xdf::load_xdf(std::string filename)
                                 eventMap.emplace_back(std::make_pair(buffer, ts), index);
                             delete[] buffer;
                         }
-                        streams[index].last_timestamp = ts;
                     }
                 }
+
+                StreamResampler* resampler = resamplers[index].get();
+                if (frames && frames->size() >= (size_t) resampler->blockFrames() * stream.info.channel_count)
+                {
+                    worker->submit([resampler, block = std::move(*frames)]() { resampler->process(block); });
+                    frames->clear();
+                }
             }
                 break;
             case 4: //read [ClockOffset] chunk
@@ -494,6 +607,37 @@ int Xdf::load_xdf(std::string filename)
         }
 
 
+        //resample what is left of each stream and collect the output rows
+        for (size_t k = 0; k < resamplers.size(); k++)
+        {
+            StreamResampler* resampler = resamplers[k].get();
+            if (!resampler)
+                continue;
+            worker->submit([resampler, block = std::move(pending[k])]()
+            {
+                if (!block.empty())
+                    resampler->process(block);
+                resampler->flush();
+            });
+        }
+        if (worker)
+        {
+            try
+            {
+                worker->finish();
+            }
+            catch (std::exception &e)
+            {
+                std::cerr << "Error resampling while loading. " << e.what() << std::endl;
+                return -1;
+            }
+        }
+        for (size_t k = 0; k < resamplers.size(); k++)
+        {
+            if (resamplers[k])
+                streams[k].time_series.swap(resamplers[k]->rows);
+        }
+
         //calculate how much time it takes to read the data
         clock_t halfWay = clock() - time;
 
@@ -507,6 +651,9 @@ int Xdf::load_xdf(std::string filename)
 
         syncTimeStamps();
 
+        if (dejitter)
+            dejitterTimeStamps();
+
         findMinMax();
 
         findMajSR();
@@ -521,6 +668,27 @@ int Xdf::load_xdf(std::string filename)
 
         calcEffectiveSrate();
 
+        if (userSrate > 0)
+        {
+            //time stamps were needed at the input rate for clock synchronization,
+            //dejittering and the effective rate; now they follow the output samples
+            for (size_t k = 0; k < resamplers.size(); k++)
+            {
+                Stream &stream = streams[k];
+                //streams whose filter cannot be designed stay at their rate
+                if (!resamplers[k] || !resamplers[k]->valid() || stream.time_series.empty())
+                    continue;
+                if (stream.time_series.front().size() != stream.time_stamps.size())
+                    resampleTimeStamps(stream, stream.info.nominal_srate / userSrate,
+                                       stream.time_series.front().size());
+                stream.sampling_interval = 1.0 / userSrate;
+            }
+
+            calcTotalLength(userSrate);
+
+            adjustTotalLength();
+        }
+
         //loading finishes, close file
         file.close();
     }
@@ -622,79 +790,310 @@ void Xdf::syncTimeStamps()
     }
 }
 
-void Xdf::resample(int userSrate)
+void Xdf::dejitterTimeStamps(double breakThresholdSeconds, int breakThresholdSamples)
+{
+    parallelFor(streams.size(), threadCount, [&](size_t k)
+    {
+        Stream &stream = streams[k];
+        std::vector<double> &ts = stream.time_stamps;
+
+        //only regular sample rate streams have a model to fit; string streams keep their stamps in eventMap
+        if (stream.info.nominal_srate <= 0 || ts.size() < 2)
+            return;
+
+        const double breakThreshold = std::max(breakThresholdSeconds,
+                                               breakThresholdSamples * stream.sampling_interval);
+
+        size_t totalCount = 0;
+        double totalDuration = 0;
+
+        size_t begin = 0;
+        while (begin < ts.size())
+        {
+            //a segment ends at the first gap larger than the threshold
+            size_t end = begin + 1;
+            while (end < ts.size() && ts[end] - ts[end - 1] <= breakThreshold)
+                end++;
+
+            const size_t n = end - begin;
+            double* t = ts.data() + begin;
+
+            if (n > 1)
+            {
+                //least-squares fit t[i] = intercept + slope * i, with i centered on the segment mean
+                //and t offset by its first value to keep the sums small; the sums are split into
+                //four independent lanes so the loop pipelines (and vectorizes) instead of
+                //serializing on one accumulator
+                const double t0 = t[0];
+                const double meanIndex = (n - 1) / 2.0;
+                double sumT[4] = { 0, 0, 0, 0 };
+                double sumIT[4] = { 0, 0, 0, 0 };
+
+                size_t i = 0;
+                for (; i + 4 <= n; i += 4)
+                {
+                    for (int j = 0; j < 4; j++)
+                    {
+                        const double y = t[i + j] - t0;
+                        sumT[j] += y;
+                        sumIT[j] += (i + j - meanIndex) * y;
+                    }
+                }
+                for (; i < n; i++)
+                {
+                    const double y = t[i] - t0;
+                    sumT[0] += y;
+                    sumIT[0] += (i - meanIndex) * y;
+                }
+
+                const double sT = (sumT[0] + sumT[1]) + (sumT[2] + sumT[3]);
+                const double sIT = (sumIT[0] + sumIT[1]) + (sumIT[2] + sumIT[3]);
+                const double sII = n * ((double)n * n - 1) / 12.0;   //sum of (i - meanIndex)^2
+
+                const double slope = sIT / sII;
+                const double intercept = t0 + sT / n - slope * meanIndex;
+
+                for (i = 0; i < n; i++)
+                    t[i] = intercept + slope * i;
+            }
+
+            totalCount += n;
+            totalDuration += t[n - 1] + stream.sampling_interval - t[0];
+
+            begin = end;
+        }
+
+        stream.info.first_timestamp = ts.front();
+        stream.info.last_timestamp = ts.back();
+        if (totalDuration > 0)
+            stream.info.effective_sample_rate = totalCount / totalDuration;
+    });
+}
+
+void Xdf::resample(int userSrate, const ResampleSpec &spec)
+{
+    resampleStreams(userSrate, spec, false);
+}
+
+void Xdf::resampleAligned(int userSrate, const ResampleSpec &spec)
+{
+    resampleStreams(userSrate, spec, true);
+}
+
+void Xdf::resampleStreams(int userSrate, const ResampleSpec &spec, bool aligned)
 {
     //if user entered a preferred sample rate, we resample all the channels to that sample rate
     //Otherwise, we resample all channels to the sample rate that has the most channels
 
     clock_t time = clock();
 
-#define BUF_SIZE 8192
-    for (auto &stream : streams)
+    //aligned output covers the grid minTS + j / userSrate, both ends included
+    if (aligned)
     {
-        if (!stream.time_series.empty() &&
-                stream.info.nominal_srate != userSrate &&
-                stream.info.nominal_srate != 0)
-        {
-            int fsin = stream.info.nominal_srate;       // input samplerate
-            int fsout = userSrate;                      // output samplerate
-            double bandwidth = 0.95;                    // bandwidth
-            double rp = 0.1;                            // passband ripple factor
-            double rs = 140;                            // stopband attenuation
-            double tol = 0.000001;                      // tolerance
-
-            // initialize smarc filter
-            struct PFilter* pfilt = smarc_init_pfilter(fsin, fsout, bandwidth, rp,
-                                                       rs, tol, NULL, 0);
-            if (pfilt == NULL)
-                continue;
-
-            // initialize smarc filter state
-            struct PState* pstate = smarc_init_pstate(pfilt);
+        calcTotalLength(userSrate);
+        totalLen++;
+    }
 
-            for (auto &row : stream.time_series)
-            {
-                // initialize buffers
-                int read = 0;
-                int written = 0;
-                const int OUT_BUF_SIZE = (int) smarc_get_output_buffer_size(pfilt, row.size());
-                double* inbuf = new double[row.size()];
-                double* outbuf = new double[OUT_BUF_SIZE];
+    //get one filter per stream; a PFilter is read-only once built, so all
+    //channels of a stream can share it while each channel gets its own PState.
+    //Filters come from the process-wide cache, so each rate pair is designed only once.
+    //Streams whose input rate is not an integer (e.g. 59.94 Hz, or a measured
+    //effective rate) get a fractional-ratio filter instead.
+    std::vector<std::shared_ptr<PFilter> > filters(streams.size());
+    std::vector<std::shared_ptr<FFilter> > fractionalFilters(streams.size());
+    std::vector<double> inputRates(streams.size());
+
+    //in aligned mode, stream k starts at grid point firstPoints[k], the first
+    //one at or after its first sample, which falls on input position startPositions[k].
+    //The sub-sample offset needs the fractional resampler even for integer
+    //ratios; streams already on the grid are only placed.
+    std::vector<size_t> firstPoints(streams.size(), 0);
+    std::vector<double> startPositions(streams.size(), 0);
+    std::vector<char> placed(streams.size(), 0);
+
+    parallelFor(streams.size(), threadCount, [&](size_t k)
+    {
+        const Stream &stream = streams[k];
+        double fsin = stream.info.nominal_srate;        // input samplerate
+        if (spec.useEffectiveRate && stream.info.effective_sample_rate > 0)
+            fsin = stream.info.effective_sample_rate;
+        inputRates[k] = fsin;
 
+        if (stream.time_series.empty() || stream.time_series.front().empty() ||
+                stream.info.nominal_srate == 0)
+            return;
 
-                std::copy(row.begin(), row.end(), inbuf);
+        int fsout = userSrate;                          // output samplerate
 
-                read = row.size();
+        if (aligned)
+        {
+            const double offset = std::max(0.0, (stream.info.first_timestamp - minTS) * fsout);
+            firstPoints[k] = (size_t) std::ceil(offset - 1e-9);
+            startPositions[k] = std::max(0.0, (firstPoints[k] - offset) / fsout * fsin);
 
-                // resample signal block
-                written = smarc_resample(pfilt, pstate, inbuf, read, outbuf, OUT_BUF_SIZE);
+            if (fsin == fsout && startPositions[k] < 1e-6)
+                placed[k] = 1;
+            else
+                fractionalFilters[k].reset(smarc_init_ffilter(fsin, fsout, spec.bandwidth, spec.rs),
+                                           smarc_destroy_ffilter);
+        }
+        else if (fsin != fsout)
+        {
+            if (fsin == std::floor(fsin))
+                filters[k] = FilterCache::get((int) fsin, fsout, spec);
+            else
+                fractionalFilters[k].reset(smarc_init_ffilter(fsin, fsout, spec.bandwidth, spec.rs),
+                                           smarc_destroy_ffilter);
+        }
+    });
+
+    //one task per block of up to CHANNEL_BLOCK channels of a stream. The channels
+    //of a block go through the filter phases together, so that each coefficient is
+    //loaded once for all of them and SIMD lanes run across channels.
+    //Largest blocks first so the pool doesn't end up waiting on one picked up last.
+    const size_t CHANNEL_BLOCK = 32;
+    struct Task
+    {
+        size_t stream;
+        size_t firstChannel;
+        size_t channelCount;
+    };
+    std::vector<Task> tasks;
+    for (size_t k = 0; k < streams.size(); k++)
+    {
+        if (filters[k] || fractionalFilters[k] || placed[k])
+        {
+            const size_t channels = streams[k].time_series.size();
+            for (size_t ch = 0; ch < channels; ch += CHANNEL_BLOCK)
+                tasks.push_back({k, ch, std::min(CHANNEL_BLOCK, channels - ch)});
+        }
+    }
+    std::stable_sort(tasks.begin(), tasks.end(), [&](const Task &a, const Task &b)
+    {
+        return streams[a.stream].time_series[a.firstChannel].size() * a.channelCount >
+               streams[b.stream].time_series[b.firstChannel].size() * b.channelCount;
+    });
 
-                // do what you want with your output
-                row.resize(written);
-                std::copy ( outbuf, outbuf+written, row.begin() );
+    parallelFor(tasks.size(), threadCount, [&](size_t t)
+    {
+        struct PFilter* pfilt = filters[tasks[t].stream].get();
+        struct FFilter* ffilt = fractionalFilters[tasks[t].stream].get();
+        std::vector<float>* rows = &streams[tasks[t].stream].time_series[tasks[t].firstChannel];
+        const int channels = (int) tasks[t].channelCount;
+        const size_t length = rows[0].size();
 
-                // flushing last values
-                written = smarc_resample_flush(pfilt, pstate, outbuf, OUT_BUF_SIZE);
+        if (!pfilt && !ffilt)
+        {
+            //already sampled on the grid, only shifted to its first point
+            for (int ch = 0; ch < channels; ch++)
+            {
+                std::vector<float> out(totalLen, 0.0f);
+                const size_t first = std::min<size_t>(firstPoints[tasks[t].stream], totalLen);
+                std::copy_n(rows[ch].begin(), std::min(length, totalLen - first), out.begin() + first);
+                rows[ch].swap(out);
+            }
+            return;
+        }
 
-                // do what you want with your output
-                row.resize(row.size() + written);
-                std::copy ( outbuf, outbuf+written, row.begin() + row.size() - written );
+        // channels are stored as float, so the float path filters them without
+        // widening to double. The filter state comes from the resamplers' pool,
+        // filled by the tasks of the same stream that ran before
+        Resampler resampler = pfilt ? Resampler(filters[tasks[t].stream], channels)
+                                    : Resampler(fractionalFilters[tasks[t].stream], channels,
+                                                startPositions[tasks[t].stream]);
+        auto outputSize = [&](size_t frames) { return (int) resampler.outputFrames(frames); };
+
+        // the rows are streamed through smarc in fixed-size blocks of frames
+        // (about 64 KB of interleaved samples), so scratch memory is constant
+        // and stays in cache whatever the length of the channels
+        const int IN_FRAMES = std::max(512, 16384 / channels);
+        const int OUT_FRAMES = outputSize(IN_FRAMES);
+        std::vector<float> inbuf(channels > 1 ? (size_t) IN_FRAMES * channels : 0);
+        std::vector<float> outbuf((size_t) OUT_FRAMES * channels);
+
+        // when downsampling, the output doesn't get ahead of the input already
+        // consumed and overwrites the rows in place; otherwise (or should it
+        // ever get ahead) it goes to new rows. Aligned output goes to new rows
+        // of the grid length, starting with zeros up to the first grid point
+        bool inPlace = !aligned && userSrate < inputRates[tasks[t].stream];
+        std::vector<std::vector<float> > resampled(channels);
+        if (aligned)
+        {
+            for (auto &out : resampled)
+            {
+                out.reserve(std::max<size_t>(totalLen, firstPoints[tasks[t].stream] + outputSize((int) length)));
+                out.assign(std::min<size_t>(firstPoints[tasks[t].stream], totalLen), 0.0f);
+            }
+        }
+        else if (!inPlace)
+        {
+            for (auto &out : resampled)
+                out.reserve(outputSize((int) length));
+        }
+        size_t consumed = 0;    // frames of the rows given to smarc
+        size_t written = 0;     // frames written in place
 
-                // you are done with converting your signal.
-                // If you want to reuse the same converter to process another signal
-                // just reset the state:
-                smarc_reset_pstate(pstate,pfilt);
+        auto store = [&](int frames)
+        {
+            inPlace = inPlace && written + frames <= consumed;
+            for (int ch = 0; ch < channels; ch++)
+            {
+                float* out;
+                if (inPlace)
+                    out = rows[ch].data() + written;
+                else
+                {
+                    const size_t offset = resampled[ch].size();
+                    resampled[ch].resize(offset + frames);
+                    out = resampled[ch].data() + offset;
+                }
+                for (int i = 0; i < frames; i++)
+                    out[i] = outbuf[(size_t) i * channels + ch];
+            }
+            if (inPlace)
+                written += frames;
+        };
 
-                delete[] inbuf;
-                delete[] outbuf;
+        while (consumed < length)
+        {
+            const int frames = (int) std::min<size_t>(IN_FRAMES, length - consumed);
+            const float* block = rows[0].data() + consumed;
+            if (channels > 1)
+            {
+                for (int ch = 0; ch < channels; ch++)
+                {
+                    const float* in = rows[ch].data() + consumed;
+                    for (int i = 0; i < frames; i++)
+                        inbuf[(size_t) i * channels + ch] = in[i];
+                }
+                block = inbuf.data();
             }
-            // release smarc filter state
-            smarc_destroy_pstate(pstate);
 
-            // release smarc filter
-            smarc_destroy_pfilter(pfilt);
+            // resample signal block
+            const int count = (int) resampler.process({ block, (size_t) frames * channels }, outbuf);
+            consumed += frames;
+            store(count);
         }
-    }
+
+        // flushing last values
+        int count;
+        while ((count = (int) resampler.flush(outbuf)) > 0)
+            store(count);
+
+        for (int ch = 0; ch < channels; ch++)
+        {
+            if (aligned)
+                resampled[ch].resize(totalLen, 0.0f);
+
+            if (written == 0)
+                rows[ch].swap(resampled[ch]);
+            else
+            {
+                rows[ch].resize(written);
+                rows[ch].insert(rows[ch].end(), resampled[ch].begin(), resampled[ch].end());
+            }
+        }
+    });
     //resampling finishes here
 
 
@@ -703,9 +1102,49 @@ void Xdf::resample(int userSrate)
     //======================================================================
 
 
-    calcTotalLength(userSrate);
+    if (aligned)
+    {
+        //every resampled stream now shares the grid; its time stamps say so
+        for (size_t k = 0; k < streams.size(); k++)
+        {
+            if (!filters[k] && !fractionalFilters[k] && !placed[k])
+                continue;
+            Stream &stream = streams[k];
+            stream.time_stamps.resize(totalLen);
+            for (size_t j = 0; j < totalLen; j++)
+                stream.time_stamps[j] = minTS + j / (double) userSrate;
+            stream.sampling_interval = 1.0 / userSrate;
+
+            //the stream's own samples span its first to its last grid point
+            const size_t first = std::min<size_t>(firstPoints[k], totalLen);
+            const double lastPoint = std::floor((stream.info.last_timestamp - minTS) * userSrate + 1e-9);
+            const size_t end = std::clamp<size_t>(lastPoint < 0 ? 0 : (size_t) lastPoint + 1, first, totalLen);
+            stream.padding_before = first;
+            stream.padding_after = totalLen - end;
+        }
+    }
+    else
+    {
+        //each resampled stream keeps its start time; its time stamps follow the
+        //output samples, as after loading with a target rate. Released time
+        //stamps keep only the first one, and the interval gives the others
+        for (size_t k = 0; k < streams.size(); k++)
+        {
+            if (!filters[k] && !fractionalFilters[k])
+                continue;
+            Stream &stream = streams[k];
+            if (stream.time_stamps.size() > 1)
+                resampleTimeStamps(stream, inputRates[k] / userSrate, stream.time_series.front().size());
+            stream.sampling_interval = 1.0 / userSrate;
+            //padding from an earlier resampleAligned() follows the new rate
+            stream.padding_before = (size_t) std::llround(stream.padding_before * userSrate / inputRates[k]);
+            stream.padding_after = (size_t) std::llround(stream.padding_after * userSrate / inputRates[k]);
+        }
+
+        calcTotalLength(userSrate);
 
-    adjustTotalLength();
+        adjustTotalLength();
+    }
 
     time = clock() - time;
 
@@ -713,6 +1152,293 @@ void Xdf::resample(int userSrate)
               << " resampling" << std::endl;
 }
 
+void Xdf::gridIrregularStreams(int srate, GridInterpolation interpolation)
+{
+    //numeric streams without a nominal sample rate; string streams hold events
+    std::vector<size_t> irregular;
+    for (size_t k = 0; k < streams.size(); k++)
+    {
+        const Stream &stream = streams[k];
+        if (stream.info.nominal_srate == 0 && stream.info.channel_format.compare("string") &&
+                !stream.time_series.empty() && stream.time_stamps.size() >= 2 &&
+                stream.time_series.front().size() == stream.time_stamps.size())
+            irregular.push_back(k);
+    }
+    if (srate <= 0 || irregular.empty())
+        return;
+
+    parallelFor(irregular.size(), threadCount, [&](size_t n)
+    {
+        Stream &stream = streams[irregular[n]];
+        const std::vector<double> &ts = stream.time_stamps;
+        const size_t count = ts.size();
+        const double interval = 1.0 / srate;
+
+        //grid points minTS + j / srate within the time range of the stream, so
+        //that the grids of all streams line up
+        const int64_t firstPoint = (int64_t) std::ceil((ts.front() - minTS) * srate);
+        const int64_t lastPoint = (int64_t) std::floor((ts.back() - minTS) * srate);
+        if (lastPoint < firstPoint)
+            return;
+        const size_t points = lastPoint - firstPoint + 1;
+
+        //weights of the four samples from `first` on for each grid point, computed
+        //once in a single sweep over the time stamps and shared by all channels
+        struct Weights
+        {
+            size_t first;
+            float w[4];
+        };
+        std::vector<Weights> weights(points);
+        const size_t window = std::min<size_t>(4, count);
+        size_t i = 0;   //ts[i] <= t < ts[i+1], or the last interval
+        for (size_t j = 0; j < points; j++)
+        {
+            const double t = minTS + (firstPoint + (int64_t) j) * interval;
+            while (i + 2 < count && ts[i + 1] <= t)
+                i++;
+
+            Weights &wt = weights[j];
+            wt.first = std::min(i > 0 ? i - 1 : 0, count - window);
+            std::fill(std::begin(wt.w), std::end(wt.w), 0.0f);
+            auto add = [&](size_t sample, double weight) { wt.w[sample - wt.first] += (float) weight; };
+
+            const double span = ts[i + 1] - ts[i];
+            const double u = span > 0 ? std::clamp((t - ts[i]) / span, 0.0, 1.0) : 0.0;
+            if (interpolation == GridInterpolation::ZeroOrderHold || span <= 0)
+                add(u < 1 ? i : i + 1, 1);
+            else if (interpolation == GridInterpolation::Linear)
+            {
+                add(i, 1 - u);
+                add(i + 1, u);
+            }
+            else
+            {
+                //cubic Hermite spline, slopes from the neighbouring samples
+                const double u2 = u * u;
+                const double u3 = u2 * u;
+                add(i, 2 * u3 - 3 * u2 + 1);
+                add(i + 1, -2 * u3 + 3 * u2);
+                const double h10 = span * (u3 - 2 * u2 + u);
+                const double h11 = span * (u3 - u2);
+                if (i > 0)
+                {
+                    const double a = 1 / (ts[i + 1] - ts[i - 1]);
+                    add(i + 1, h10 * a);
+                    add(i - 1, -h10 * a);
+                }
+                else
+                {
+                    add(i + 1, h10 / span);
+                    add(i, -h10 / span);
+                }
+                if (i + 2 < count)
+                {
+                    const double a = 1 / (ts[i + 2] - ts[i]);
+                    add(i + 2, h11 * a);
+                    add(i, -h11 * a);
+                }
+                else
+                {
+                    add(i + 1, h11 / span);
+                    add(i, -h11 / span);
+                }
+            }
+        }
+
+        //apply the weights a block of grid points at a time, on interleaved
+        //frames so that the inner loop runs across channels
+        const int channels = (int) stream.time_series.size();
+        std::vector<std::vector<float> > gridded(channels, std::vector<float>(points));
+        const size_t BLOCK = 4096;
+        std::vector<float> frames;
+        std::vector<float> out(BLOCK * channels);
+        for (size_t j0 = 0; j0 < points; j0 += BLOCK)
+        {
+            const size_t j1 = std::min(points, j0 + BLOCK);
+            const size_t base = weights[j0].first;
+            const size_t end = std::min(count, weights[j1 - 1].first + 4);
+            frames.assign((end - base + 4) * channels, 0.0f);
+            for (int ch = 0; ch < channels; ch++)
+            {
+                const float* in = stream.time_series[ch].data();
+                for (size_t s = base; s < end; s++)
+                    frames[(s - base) * channels + ch] = in[s];
+            }
+
+            for (size_t j = j0; j < j1; j++)
+            {
+                const Weights &wt = weights[j];
+                const float* a = frames.data() + (wt.first - base) * channels;
+                float* o = out.data() + (j - j0) * channels;
+                for (int c = 0; c < channels; c++)
+                    o[c] = wt.w[0] * a[c] + wt.w[1] * a[channels + c] +
+                           wt.w[2] * a[2 * channels + c] + wt.w[3] * a[3 * channels + c];
+            }
+
+            for (int ch = 0; ch < channels; ch++)
+            {
+                float* row = gridded[ch].data();
+                for (size_t j = j0; j < j1; j++)
+                    row[j] = out[(j - j0) * channels + ch];
+            }
+        }
+
+        //the stream is now regular
+        stream.time_series.swap(gridded);
+        std::vector<double> grid(points);
+        for (size_t j = 0; j < points; j++)
+            grid[j] = minTS + (firstPoint + (int64_t) j) * interval;
+        stream.time_stamps.swap(grid);
+        stream.info.nominal_srate = srate;
+        stream.info.effective_sample_rate = srate;
+        stream.info.sample_count = (int) points;
+        stream.info.first_timestamp = stream.time_stamps.front();
+        stream.info.last_timestamp = stream.time_stamps.back();
+        stream.sampling_interval = interval;
+    });
+
+    findMajSR();
+
+    getHighestSampleRate();
+
+    sampleRateMap.clear();
+    loadSampleRateMap();
+}
+
+Xdf::EventSampleTable Xdf::mapEventsToSamples() const
+{
+    EventSampleTable table;
+    table.eventCount = eventMap.size();
+    table.indices.assign(streams.size() * eventMap.size(), -1);
+
+    //visit the events in time order so every stream needs just one forward pass
+    std::vector<size_t> order(eventMap.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+    {
+        return eventMap[a].first.second < eventMap[b].first.second;
+    });
+
+    parallelFor(streams.size(), threadCount, [&](size_t k)
+    {
+        const Stream &stream = streams[k];
+        if (stream.time_series.empty() || stream.time_series.front().empty() || stream.time_stamps.empty())
+            return;
+
+        const size_t count = stream.time_series.front().size();
+        const double halfInterval = stream.sampling_interval / 2;
+        int64_t* row = table.indices.data() + k * table.eventCount;
+
+        //samples padding the stream on an aligned grid map nothing
+        const size_t begin = std::min(stream.padding_before, count);
+        const size_t end = count - std::min(stream.padding_after, count - begin);
+        if (begin == end)
+            return;
+
+        if (stream.time_stamps.size() != count)
+        {
+            //time stamps were released, use the model at the rate of the samples;
+            //stamps that do not describe the samples map nothing
+            if (stream.time_stamps.size() != 1 || stream.sampling_interval <= 0)
+                return;
+            const double first = stream.time_stamps.front();
+            for (size_t e : order)
+            {
+                const double position = std::round((eventMap[e].first.second - first) / stream.sampling_interval);
+                if (position >= (double)begin && position < (double)end)
+                    row[e] = (int64_t)position;
+            }
+            return;
+        }
+
+        const double* ts = stream.time_stamps.data();
+        size_t i = begin;
+        for (size_t e : order)
+        {
+            const double t = eventMap[e].first.second;
+            if (t < ts[begin] - halfInterval || t > ts[end - 1] + halfInterval)
+                continue;
+
+            while (i + 1 < end && ts[i + 1] <= t)
+                i++;
+            row[e] = (i + 1 < end && ts[i + 1] - t < t - ts[i]) ? i + 1 : i;
+        }
+    });
+
+    return table;
+}
+
+void Xdf::replay(const std::function<bool(const ReplayChunk&)> &callback,
+                 ReplayMode mode, double speed, double chunkDuration) const
+{
+    using Clock = std::chrono::steady_clock;
+
+    if (chunkDuration <= 0)
+        return;
+    if (mode == ReplayMode::WallClock)
+        speed = 1.0;
+    if (speed <= 0)
+        mode = ReplayMode::AsFastAsPossible;
+
+    //samples and events come in time order from the iterator. A slice's samples
+    //of one stream are consecutive, so each stream needs only a count; the
+    //chunks and events are listed in the order of their first sample.
+    //Everything is set up here so that the replay loop itself never allocates.
+    TimeOrderedIterator it(*this);
+    const TimeOrderedIterator end;
+    std::vector<size_t> counts(streams.size(), 0);
+    std::vector<TimeOrderedSample> chunks;
+    chunks.reserve(streams.size() + eventMap.size());
+
+    //sleep until shortly before the deadline, then spin: sleep granularity is
+    //often around a millisecond, spinning is accurate to well below that
+    auto waitUntil = [](Clock::time_point deadline)
+    {
+        const auto spinMargin = std::chrono::milliseconds(2);
+        if (Clock::now() < deadline - spinMargin)
+            std::this_thread::sleep_until(deadline - spinMargin);
+        while (Clock::now() < deadline)
+            std::this_thread::yield();
+    };
+
+    //with a missing or infinite time range, everything goes in one slice
+    const Clock::time_point start = Clock::now();
+    const bool bounded = std::isfinite(minTS) && std::isfinite(maxTS);
+
+    for (uint64_t slice = 1; it != end; slice++)
+    {
+        //the last slice takes whatever is left, including samples with invalid time stamps
+        const double sliceEnd = minTS + slice * chunkDuration;
+        const bool lastSlice = !bounded || sliceEnd > maxTS;
+
+        if (mode != ReplayMode::AsFastAsPossible)
+            waitUntil(start + std::chrono::duration_cast<Clock::duration>(
+                          std::chrono::duration<double>(slice * chunkDuration / speed)));
+
+        for (; it != end && (lastSlice || it->timestamp < sliceEnd); ++it)
+        {
+            //events are delivered one at a time
+            if (it->event || counts[it->stream]++ == 0)
+                chunks.push_back(*it);
+        }
+
+        for (const TimeOrderedSample &first : chunks)
+        {
+            ReplayChunk chunk;
+            chunk.stream = first.stream;
+            chunk.first = first.index;
+            chunk.count = first.event ? 1 : std::exchange(counts[first.stream], 0);
+            chunk.timestamp = first.timestamp;
+            chunk.event = first.event;
+
+            if (!callback(chunk))
+                return;
+        }
+        chunks.clear();
+    }
+}
+
 //function of reading the length of each chunk
 uint64_t Xdf::readLength(std::ifstream &file)
 {
@@ -893,9 +1619,11 @@ void Xdf::calcEffectiveSrate()
         {
             try
             {
-                stream.info.effective_sample_rate
-                        = stream.info.sample_count /
-                        (stream.info.last_timestamp - stream.info.first_timestamp);
+                //dejitterTimeStamps() may already have measured the rate from its fit
+                if (!stream.info.effective_sample_rate)
+                    stream.info.effective_sample_rate
+                            = stream.info.sample_count /
+                            (stream.info.last_timestamp - stream.info.first_timestamp);
 
                 if (stream.info.effective_sample_rate)
                     effectiveSampleRateVector.emplace_back(stream.info.effective_sample_rate);
@@ -922,6 +1650,133 @@ void Xdf::calcEffectiveSrate()
     }
 }
 
+Xdf::TimeOrderedIterator::TimeOrderedIterator(const Xdf &xdf)
+    : xdf(&xdf)
+{
+    //events of one stream are interleaved with other streams' events in eventMap,
+    //so collect per-stream index lists (events are few compared to samples)
+    auto indices = std::make_shared<std::vector<std::vector<size_t> > >(xdf.streams.size());
+    for (size_t i = 0; i < xdf.eventMap.size(); i++)
+        (*indices)[xdf.eventMap[i].second].emplace_back(i);
+    eventIndices = indices;
+
+    sources.resize(xdf.streams.size());
+    for (size_t k = 0; k < xdf.streams.size(); k++)
+    {
+        const Stream &stream = xdf.streams[k];
+        Source &source = sources[k];
+        source.time_stamps = nullptr;
+        source.first_timestamp = 0;
+        source.sampling_interval = stream.sampling_interval;
+        source.events = nullptr;
+
+        size_t count = 0;
+        if (stream.info.channel_format.compare("string") == 0)
+        {
+            source.events = &(*eventIndices)[k];
+            count = source.events->size();
+        }
+        else if (!stream.time_series.empty())
+        {
+            //either one time stamp per sample, or only the first one after
+            //freeUpTimeStamps(); anything else does not describe the samples
+            count = stream.time_series.front().size();
+            if (stream.time_stamps.size() == count)
+                source.time_stamps = stream.time_stamps.data();
+            else if (stream.time_stamps.size() == 1 && stream.sampling_interval > 0)
+                source.first_timestamp = stream.time_stamps.front();
+            else
+                count = 0;
+        }
+
+        if (count > 0)
+        {
+            Cursor cursor{ 0, (int)k, 0, count };
+            cursor.timestamp = timestampAt(cursor);
+            heap.emplace_back(cursor);
+        }
+    }
+
+    for (size_t i = heap.size() / 2; i-- > 0;)
+        siftDown(i);
+
+    updateCurrent();
+}
+
+Xdf::TimeOrderedIterator& Xdf::TimeOrderedIterator::operator++()
+{
+    if (heap.empty())
+        return *this;
+
+    Cursor &top = heap.front();
+    if (++top.position < top.end)
+        top.timestamp = timestampAt(top);
+    else
+    {
+        top = heap.back();
+        heap.pop_back();
+    }
+
+    if (!heap.empty())
+        siftDown(0);
+
+    updateCurrent();
+    return *this;
+}
+
+double Xdf::TimeOrderedIterator::timestampAt(const Cursor &cursor) const
+{
+    const Source &source = sources[cursor.stream];
+    if (source.time_stamps)
+        return source.time_stamps[cursor.position];
+    if (source.events)
+        return xdf->eventMap[(*source.events)[cursor.position]].first.second;
+    return source.first_timestamp + cursor.position * source.sampling_interval;
+}
+
+void Xdf::TimeOrderedIterator::siftDown(size_t i)
+{
+    //replace-top sift: one pass down the tree instead of a separate pop and push
+    auto before = [](const Cursor &a, const Cursor &b)
+    {
+        return a.timestamp < b.timestamp || (a.timestamp == b.timestamp && a.stream < b.stream);
+    };
+
+    const size_t n = heap.size();
+    const Cursor cursor = heap[i];
+    while (true)
+    {
+        size_t child = 2 * i + 1;
+        if (child >= n)
+            break;
+        if (child + 1 < n && before(heap[child + 1], heap[child]))
+            child++;
+        if (!before(heap[child], cursor))
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = cursor;
+}
+
+void Xdf::TimeOrderedIterator::updateCurrent()
+{
+    if (heap.empty())
+        return;
+
+    const Cursor &top = heap.front();
+    const Source &source = sources[top.stream];
+    current.stream = top.stream;
+    current.index = source.events ? (*source.events)[top.position] : top.position;
+    current.timestamp = top.timestamp;
+    current.event = source.events != nullptr;
+}
+
+Xdf::TimeOrderedRange Xdf::timeOrdered() const
+{
+    return TimeOrderedRange{ this };
+}
+
 int Xdf::writeEventsToXDF(std::string file_path)
 {
     if (userAddedStream)
@@ -1091,6 +1946,52 @@ void Xdf::loadDictionary()
     }
 }
 
+template<typename T> void Xdf::readSamples(std::ifstream &file, Stream &stream, uint64_t numSamp,
+                                           std::vector<float>* frames)
+{
+    //if the time series is empty
+    if (stream.time_series.empty() && !frames)
+        stream.time_series.resize(stream.info.channel_count);
+
+    //number of samples without a time stamp since the last one that had one;
+    //their time stamps are deduced in one go once the run ends
+    uint64_t deduced = 0;
+
+    //for each sample
+    for (size_t i = 0; i < numSamp; i++)
+    {
+        //read or deduce time stamp
+        auto tsBytes = readBin<uint8_t>(file);
+
+        if (tsBytes == 8)
+        {
+            appendDeducedTimeStamps(stream, deduced);
+            deduced = 0;
+
+            double ts;
+            Xdf::readBin(file, &ts);
+            stream.time_stamps.emplace_back(ts);
+            stream.last_timestamp = ts;
+            stream.deduced_count = 0;
+        }
+        else
+            deduced++;
+
+        //read the data
+        for (int v = 0; v < stream.info.channel_count; ++v)
+        {
+            T data;
+            Xdf::readBin(file, &data);
+            if (frames)
+                frames->emplace_back(data);
+            else
+                stream.time_series[v].emplace_back(data);
+        }
+    }
+
+    appendDeducedTimeStamps(stream, deduced);
+}
+
 template<typename T> T Xdf::readBin(std::istream& is, T* obj) {
 	T dummy;
 	if(!obj) obj = &dummy;
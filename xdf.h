@@ -15,6 +15,12 @@
 #include <map>
 #include <set>
 #include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+
+#include "resampling.h"
 
 /*! \class Xdf
  *
@@ -66,12 +72,154 @@ public:
             double effective_sample_rate = 0;/*!< Effective sample rate. */
         } info; /*!< Meta-data from the stream header of the current stream. */
 
-        double last_timestamp{ 0 };  /*!< For temporary use while loading the vector */
-        double sampling_interval;    /*!< If srate > 0, sampling_interval = 1/srate; otherwise 0 */
+        double last_timestamp{ 0 };  /*!< For temporary use while loading the vector: the last time stamp stored in the file */
+        uint64_t deduced_count{ 0 }; /*!< For temporary use while loading the vector: samples deduced since `last_timestamp` */
+        double sampling_interval;    /*!< Interval of the samples in `time_series`: 1/srate, or 1/userSrate once resampled; 0 for irregular streams */
+        size_t padding_before{ 0 };  /*!< Samples of `time_series` before the stream's first recorded one, zeros added by resampleAligned() */
+        size_t padding_after{ 0 };   /*!< Samples of `time_series` after the stream's last recorded one, zeros added by resampleAligned() */
         std::vector<double> clock_times;/*!< Vector of clock times from clock offset chunk (Tag 4). */
         std::vector<double> clock_values;/*!< Vector of clock values from clock offset chunk (Tag 4). */
     };
 
+    /*!
+     * \brief A sample or event visited by TimeOrderedIterator.
+     */
+    struct TimeOrderedSample
+    {
+        int stream;         /*!< Index of the stream in `streams`. */
+        size_t index;       /*!< Sample index into the stream's `time_series` rows, or index into `eventMap` for events. */
+        double timestamp;   /*!< Time stamp of the sample or event. */
+        bool event;         /*!< True if the entry is an event of a string stream. */
+    };
+
+    /*! \class TimeOrderedIterator
+     *
+     * Visits all samples of all numeric streams together with all events in
+     * `eventMap` in global time stamp order, without copying any data.
+     *
+     * Each stream contributes a cursor to a binary min-heap keyed by the time
+     * stamp of its next sample, so stepping the iterator costs O(log k) for k
+     * streams. Within a stream, samples are always visited in index order (so
+     * jittered time stamps may step back slightly; see load_xdf() for
+     * dejittering). Samples with equal time stamps are visited in stream order.
+     * If a stream's time stamps were released with freeUpTimeStamps(), its
+     * sample times are derived from the first time stamp and `sampling_interval`.
+     * Streams whose time stamps match neither case are skipped.
+     *
+     * The iterator refers to the Xdf object it was created from, which must not
+     * be modified while iterating.
+     *
+     * \sa timeOrdered()
+     */
+    class TimeOrderedIterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = TimeOrderedSample;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const TimeOrderedSample*;
+        using reference = const TimeOrderedSample&;
+
+        //! Create an end iterator.
+        TimeOrderedIterator() = default;
+        //! Create an iterator positioned at the earliest sample or event of `xdf`.
+        explicit TimeOrderedIterator(const Xdf &xdf);
+
+        reference operator*() const { return current; }
+        pointer operator->() const { return &current; }
+        TimeOrderedIterator& operator++();
+
+        //! Two iterators compare equal if both are exhausted.
+        bool operator==(const TimeOrderedIterator &other) const { return heap.empty() && other.heap.empty(); }
+        bool operator!=(const TimeOrderedIterator &other) const { return !(*this == other); }
+
+    private:
+        struct Source
+        {
+            const double* time_stamps;  //null if the times follow the nominal rate model
+            double first_timestamp;
+            double sampling_interval;
+            const std::vector<size_t>* events;  //indices into eventMap for string streams
+        };
+
+        struct Cursor
+        {
+            double timestamp;
+            int stream;
+            size_t position;
+            size_t end;
+        };
+
+        double timestampAt(const Cursor &cursor) const;
+        void siftDown(size_t i);
+        void updateCurrent();
+
+        const Xdf* xdf = nullptr;
+        std::shared_ptr<const std::vector<std::vector<size_t> > > eventIndices;
+        std::vector<Source> sources;
+        std::vector<Cursor> heap;
+        TimeOrderedSample current{};
+    };
+
+    /*!
+     * \brief A range over all samples and events in time order, for use in
+     * range-based for loops.
+     * \sa timeOrdered(), TimeOrderedIterator
+     */
+    struct TimeOrderedRange
+    {
+        const Xdf* xdf;
+        TimeOrderedIterator begin() const { return TimeOrderedIterator(*xdf); }
+        TimeOrderedIterator end() const { return TimeOrderedIterator(); }
+    };
+
+    /*!
+     * \brief A block of consecutive samples of one stream, or a single event,
+     * handed to the callback of replay().
+     */
+    struct ReplayChunk
+    {
+        int stream;         /*!< Index of the stream in `streams`. */
+        size_t first;       /*!< First sample index into the stream's `time_series` rows, or index into `eventMap` for events. */
+        size_t count;       /*!< Number of samples in the chunk (1 for events). */
+        double timestamp;   /*!< Time stamp of the first sample or of the event. */
+        bool event;         /*!< True if the chunk is an event of a string stream. */
+    };
+
+    /*!
+     * \brief Nearest sample index of every event in every stream, as computed by mapEventsToSamples().
+     */
+    struct EventSampleTable
+    {
+        size_t eventCount = 0;          /*!< Number of columns, equal to the size of `eventMap`. */
+        std::vector<int64_t> indices;   /*!< Row-major table with one row per stream and one column per event.
+                                         * -1 marks events outside the time range of a stream, and all
+                                         * entries of string streams. */
+
+        //! Nearest sample index of event `event` (index into `eventMap`) in stream `stream`.
+        int64_t at(int stream, size_t event) const { return indices[stream * eventCount + event]; }
+    };
+
+    /*!
+     * \brief Pacing of replay().
+     */
+    enum class ReplayMode
+    {
+        WallClock,          /*!< Deliver data at the pace it was recorded. */
+        Accelerated,        /*!< Deliver data `speed` times faster than it was recorded. */
+        AsFastAsPossible    /*!< Deliver data without waiting. */
+    };
+
+    /*!
+     * \brief Interpolation used by gridIrregularStreams().
+     */
+    enum class GridInterpolation
+    {
+        ZeroOrderHold,      /*!< Value of the last sample at or before each grid point. */
+        Linear,             /*!< Linear interpolation between the two surrounding samples. */
+        Cubic               /*!< Cubic Hermite spline through the four surrounding samples. */
+    };
+
     //XDF properties=================================================================================
 
     std::vector<Stream> streams; /*!< A vector to store all the streams of the current XDF file. */
@@ -116,6 +264,8 @@ public:
                                           * the events will be stored in a new stream after all current streams.
                                           * The index will be userAddedStream.  */
     std::vector<std::pair<std::string, double> > userCreatedEvents;/*!< User created events in Sigviewer. */
+    unsigned int threadCount = 0;       /*!< Number of worker threads used by operations that run in parallel
+                                         * across streams or channels. 0 means one per hardware thread. */
 
     //Public Functions==============================================================================================
 
@@ -180,21 +330,175 @@ public:
      * \brief The main function of loading an XDF file.
      * \param filename is the path to the file being loaded including the
      * file name.
+     * \param dejitter if true, the time stamps of regular sample rate streams
+     * are replaced by a least-squares linear fit (see dejitterTimeStamps()),
+     * and the effective sample rate is taken from that fit.
+     */
+    int load_xdf(std::string filename, bool dejitter = false);
+
+    /*!
+     * \brief Load an XDF file and resample its numeric streams to `userSrate` while decoding.
+     *
+     * Equivalent to load_xdf() followed by resample(), but full-rate samples
+     * are never stored: each stream's samples are collected in blocks of
+     * about 64 KB as the Samples chunks are decoded, and every full block is
+     * resampled on a worker thread while the following chunks are read. Only
+     * output-rate samples are kept, which matters when a high-rate stream is
+     * reduced to a much lower rate. With `threadCount` set to 1, blocks are
+     * resampled on the reading thread.
+     *
+     * Time stamps are kept at the input rate while loading, for clock
+     * synchronization, dejittering and the effective sample rate, and are
+     * then interpolated to the output samples. Streams are resampled from
+     * their nominal rate (ResampleSpec::useEffectiveRate does not apply, the
+     * effective rate is only known at the end of the file).
+     *
+     * \param filename is the path to the file being loaded including the file name.
+     * \param dejitter see load_xdf().
+     * \param userSrate is the output sample rate, 0 to keep the original rates.
+     * \param spec Filter design parameters, as for resample().
+     * \return 0 on success, 1 if the file cannot be opened, -1 if it is not an
+     * XDF file or resampling fails.
+     * \sa resample(), threadCount
      */
-    int load_xdf(std::string filename);
+    int load_xdf(std::string filename, bool dejitter, int userSrate, const ResampleSpec &spec = ResampleSpec());
+
+    /*!
+     * \brief Map every event in `eventMap` to the nearest sample index of
+     * every numeric stream.
+     *
+     * The events are sorted by time stamp once, and each stream is then
+     * matched against them in a single merge pass over its `time_stamps`.
+     * Streams whose time stamps were released with freeUpTimeStamps() use the
+     * first time stamp and `sampling_interval` instead, so the indices follow
+     * the rate `time_series` is at, resampled or not. Streams whose time stamps
+     * match neither case are mapped to -1. Streams are processed in parallel,
+     * using up to `threadCount` threads.
+     *
+     * An event is outside the time range of a stream, and mapped to -1, if it
+     * is more than half a sampling interval before the first or after the last
+     * recorded sample of the stream. The zeros resampleAligned() pads streams
+     * with (`padding_before` and `padding_after`) are not recorded samples.
+     *
+     * \sa EventSampleTable, eventMap
+     */
+    EventSampleTable mapEventsToSamples() const;
+
+    /*!
+     * \brief Replay the loaded streams and events in time order, paced by their time stamps.
+     *
+     * The recording is cut into consecutive time slices of `chunkDuration`
+     * seconds, starting at `minTS`. When a slice is due, `callback` is called
+     * once for every numeric stream with samples in that slice (with all of
+     * them as one chunk) and once for every event in it, in the order of the
+     * first sample of each chunk, as visited by timeOrdered(). Samples with
+     * invalid time stamps go in the last slice, and everything goes in one
+     * slice if `minTS` or `maxTS` is not finite. A slice is due when
+     * its end has been reached on the wall clock, scaled by `speed` in
+     * `ReplayMode::Accelerated` mode. Waits sleep until shortly before the
+     * deadline and spin the rest, so chunks are delivered with sub-millisecond
+     * jitter. Nothing is allocated once replay has started.
+     *
+     * \param callback is called for every chunk; return false to stop the replay.
+     * \param mode is the pacing mode.
+     * \param speed is the acceleration factor used in `ReplayMode::Accelerated` mode.
+     * \param chunkDuration is the length of a time slice in seconds.
+     *
+     * \sa ReplayChunk, ReplayMode, timeOrdered()
+     */
+    void replay(const std::function<bool(const ReplayChunk&)> &callback,
+                ReplayMode mode = ReplayMode::WallClock, double speed = 1.0,
+                double chunkDuration = 0.01) const;
 
     /*!
      * \brief Resample all streams and channel to a chosen sample rate
+     *
+     * Channels are resampled in blocks of up to 32 channels of a stream, which
+     * go through the filter together. The blocks of all streams run in
+     * parallel on up to `threadCount` threads, sharing one filter per stream.
+     * The result does not depend on the number of threads.
+     *
+     * Streams whose input rate is not an integer, such as 59.94 Hz or the
+     * effective rate used with ResampleSpec::useEffectiveRate, go through a
+     * fractional-ratio resampler (Kaiser windowed sinc with interpolated
+     * phases) designed from the same bandwidth and stopband attenuation.
+     *
+     * The `time_stamps` of resampled streams are interpolated to the output
+     * samples and their `sampling_interval` becomes 1/userSrate, so
+     * timeOrdered(), mapEventsToSamples() and replay() see the output rate.
+     *
      * \param userSrate is recommended to be between integer 1 and
      * the highest sample rate of the current file.
+     * \param spec Filter design parameters, e.g. `ResampleSpec::preset(ResampleQuality::Draft)`
+     * for a fast, lower-accuracy resampling.
+     * \sa threadCount
+     */
+    void resample(int userSrate, const ResampleSpec &spec = ResampleSpec());
+
+    /*!
+     * \brief Resample all regular streams onto one time grid shared by all streams.
+     *
+     * resample() converts each stream to `userSrate` but keeps its own start
+     * time, so sample `j` of two streams generally refers to different times.
+     * Here the output sample `j` of every stream is the signal at
+     * `minTS + j / userSrate`: each stream is resampled from its
+     * `first_timestamp` to the grid points it covers, sub-sample offset
+     * included, and written straight into a row of `totalLen` samples.
+     * Grid points before a stream starts or after it ends are 0; the stream's
+     * `padding_before` and `padding_after` count them.
+     *
+     * The resampled streams' `time_stamps` are set to the grid points, so
+     * mapEventsToSamples() and other consumers of time stamps see the
+     * aligned times. Streams without a nominal sample rate are left as they
+     * are; grid them with gridIrregularStreams() first.
+     *
+     * Because of the sub-sample offsets, streams always go through the
+     * fractional-ratio resampler, except those already on the grid.
+     *
+     * \param userSrate Sample rate of the grid.
+     * \param spec Filter design parameters; `bandwidth`, `rs` and `useEffectiveRate` apply.
+     * \sa resample(), totalLen, minTS
      */
-    void resample(int userSrate);
+    void resampleAligned(int userSrate, const ResampleSpec &spec = ResampleSpec());
+
+    /*!
+     * \brief Interpolate numeric streams without a nominal sample rate (eye
+     * trackers, event-driven sensors...) onto a regular grid.
+     *
+     * The grid points are `minTS + j / srate`, restricted to the time range of
+     * each stream, so gridded streams line up with each other and join the
+     * common time base used by `totalLen` and `majSR`. The interpolation
+     * weights are computed once per grid point and shared by all channels.
+     * Streams are gridded in parallel on up to `threadCount` threads.
+     *
+     * Gridded streams become regular: their `nominal_srate` is set to
+     * `srate` and `time_stamps` hold the grid points. Call it before
+     * resample() so that they are resampled with the other streams.
+     *
+     * \param srate Sample rate of the grid.
+     * \param interpolation How values between samples are computed.
+     * \sa resample()
+     */
+    void gridIrregularStreams(int srate, GridInterpolation interpolation = GridInterpolation::Linear);
 
     /*!
      * \brief syncTimeStamps
      */
     void syncTimeStamps();
 
+    /*!
+     * \brief Iterate over all samples of all streams and all events in
+     * global time stamp order.
+     *
+     * For example:
+     *
+     *     for (const auto &sample : XDFdata.timeOrdered())
+     *         process(sample.stream, sample.index, sample.timestamp);
+     *
+     * \sa TimeOrderedIterator
+     */
+    TimeOrderedRange timeOrdered() const;
+
     /*!
      * \brief writeEventsToXDF
      *
@@ -224,6 +528,27 @@ private:
      */
     void calcTotalChannel();
 
+    /*!
+     * \brief Shared implementation of resample() and resampleAligned().
+     */
+    void resampleStreams(int userSrate, const ResampleSpec &spec, bool aligned);
+
+    /*!
+     * \brief Remove the jitter from the time stamps of regular sample rate streams.
+     *
+     * Each stream is split into segments wherever two consecutive time stamps
+     * are further apart than `breakThresholdSeconds` or `breakThresholdSamples`
+     * sampling intervals (whichever is larger). Within each segment the time
+     * stamps are replaced by a least-squares fit of time stamp against sample
+     * index. The fitted first and last time stamps and the resulting effective
+     * sample rate are written back into `Stream::info`.
+     *
+     * Streams are processed in parallel, using up to `threadCount` threads.
+     *
+     * \sa load_xdf(), threadCount
+     */
+    void dejitterTimeStamps(double breakThresholdSeconds = 1.0, int breakThresholdSamples = 500);
+
     /*!
      * \brief Find the sample rate that has the most channels.
      *
@@ -300,6 +625,22 @@ private:
      * \return the read data
      */
     template<typename T> T readBin(std::istream& is, T* obj = nullptr);
+
+    /*!
+     * \brief Read the samples of a numeric [Samples] chunk into a stream.
+     *
+     * Samples without a time stamp of their own get one deduced from the
+     * last time stamp in the file as `last_timestamp + k * sampling_interval`.
+     *
+     * \param file is the XDF file that is being loaded.
+     * \param stream is the stream the chunk belongs to.
+     * \param numSamp is the number of samples in the chunk.
+     * \param frames if not null, receives the samples as interleaved frames
+     * instead of the rows of `time_series`.
+     * \tparam T is the channel format of the stream.
+     */
+    template<typename T> void readSamples(std::ifstream &file, Stream &stream, uint64_t numSamp,
+                                          std::vector<float>* frames = nullptr);
 };
 
 #endif // XDF_H